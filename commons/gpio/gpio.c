@@ -107,6 +107,142 @@ static enum hrtimer_restart debounceTimerHandler(struct hrtimer *tmr) {
   return HRTIMER_NORESTART;
 }
 
+static bool blinkPwmActive(struct BlinkGpioBean *b) {
+  return b->val && b->pwmPeriod_usec > 0 && b->pwmDuty > 0 &&
+         b->pwmDuty < 100;
+}
+
+static u64 blinkPwmTime_nsec(struct BlinkGpioBean *b, bool high) {
+  u64 on = (u64)b->pwmPeriod_usec * NSEC_PER_USEC * b->pwmDuty / 100;
+  return high ? on : (u64)b->pwmPeriod_usec * NSEC_PER_USEC - on;
+}
+
+/*
+ * Software PWM of an output that is on: GPIO16 and GPIO20 have no hardware
+ * PWM function. The timer stops by itself once the output is off or the PWM
+ * is disabled.
+ */
+static enum hrtimer_restart blinkPwmTimerHandler(struct hrtimer *tmr) {
+  struct BlinkGpioBean *b;
+  unsigned long flags;
+  enum hrtimer_restart res = HRTIMER_RESTART;
+
+  b = container_of(tmr, struct BlinkGpioBean, pwmTimer);
+
+  spin_lock_irqsave(&b->pwmLock, flags);
+  if (blinkPwmActive(b)) {
+    b->pwmHigh = !b->pwmHigh;
+    gpioSetVal(&b->gpio, b->pwmHigh);
+    // forward from now, so that a late interrupt skips periods instead of
+    // firing back to back to catch up
+    hrtimer_forward_now(tmr, ns_to_ktime(blinkPwmTime_nsec(b, b->pwmHigh)));
+  } else {
+    gpioSetVal(&b->gpio, b->val && b->pwmDuty > 0);
+    b->pwmRunning = false;
+    res = HRTIMER_NORESTART;
+  }
+  spin_unlock_irqrestore(&b->pwmLock, flags);
+
+  return res;
+}
+
+/*
+ * Applies the current level and PWM settings to the output. Must be called
+ * with pwmLock held.
+ */
+static void blinkPwmUpdate(struct BlinkGpioBean *b) {
+  if (blinkPwmActive(b)) {
+    if (!b->pwmRunning) {
+      b->pwmRunning = true;
+      b->pwmHigh = true;
+      gpioSetVal(&b->gpio, 1);
+      hrtimer_start(&b->pwmTimer, ns_to_ktime(blinkPwmTime_nsec(b, true)),
+                    HRTIMER_MODE_REL);
+    }
+  } else {
+    gpioSetVal(&b->gpio, b->val && b->pwmDuty > 0);
+  }
+}
+
+/*
+ * Sets the output level, through the software PWM if enabled.
+ */
+static void blinkSetVal(struct BlinkGpioBean *b, int val) {
+  unsigned long flags;
+
+  spin_lock_irqsave(&b->pwmLock, flags);
+  b->val = val;
+  blinkPwmUpdate(b);
+  spin_unlock_irqrestore(&b->pwmLock, flags);
+}
+
+static void blinkSetPwm(struct BlinkGpioBean *b, unsigned int period_usec,
+                        unsigned int duty) {
+  unsigned long flags;
+
+  spin_lock_irqsave(&b->pwmLock, flags);
+  b->pwmPeriod_usec = period_usec;
+  b->pwmDuty = duty;
+  blinkPwmUpdate(b);
+  spin_unlock_irqrestore(&b->pwmLock, flags);
+}
+
+/*
+ * Plays the blink pattern: each expiration moves to the next step and
+ * schedules the following one relative to the previous expiration, so that
+ * timings do not drift. The pattern ends with the output off, skipping the
+ * trailing off step of the last repetition.
+ */
+static enum hrtimer_restart blinkTimerHandler(struct hrtimer *tmr) {
+  struct BlinkGpioBean *b;
+  struct BlinkStep *st;
+
+  b = container_of(tmr, struct BlinkGpioBean, timer);
+
+  if (++b->step == b->stepsNum) {
+    b->step = 0;
+    if (b->rep > 0) {
+      WRITE_ONCE(b->rep, b->rep - 1);
+    }
+  }
+  st = &b->steps[b->step];
+
+  if (b->rep == 0 ||
+      (b->rep == 1 && b->step == b->stepsNum - 1 && st->val == 0)) {
+    blinkSetVal(b, 0);
+    WRITE_ONCE(b->running, false);
+    return HRTIMER_NORESTART;
+  }
+
+  blinkSetVal(b, st->val);
+  hrtimer_add_expires(tmr, ms_to_ktime(st->time_msec));
+  return HRTIMER_RESTART;
+}
+
+/*
+ * Replaces the running pattern, if any, with the given one. An empty
+ * pattern just stops the running one and switches the output off.
+ */
+static void blinkStart(struct BlinkGpioBean *b, const struct BlinkStep *steps,
+                       int stepsNum, long rep) {
+  mutex_lock(&b->lock);
+  hrtimer_cancel(&b->timer);
+  b->running = false;
+  if (stepsNum > 0) {
+    memcpy(b->steps, steps, stepsNum * sizeof(*steps));
+    b->stepsNum = stepsNum;
+    b->step = 0;
+    b->rep = rep;
+    b->running = true;
+    blinkSetVal(b, steps[0].val);
+    hrtimer_start(&b->timer, ms_to_ktime(steps[0].time_msec),
+                  HRTIMER_MODE_REL);
+  } else {
+    blinkSetVal(b, 0);
+  }
+  mutex_unlock(&b->lock);
+}
+
 void gpioSetPlatformDev(struct platform_device *pdev) { _pdev = pdev; }
 
 int gpioInit(struct GpioBean *g) {
@@ -151,6 +287,32 @@ int gpioInitDebounce(struct DebouncedGpioBean *d) {
   return res;
 }
 
+int gpioInitBlink(struct BlinkGpioBean *b) {
+  mutex_init(&b->lock);
+  spin_lock_init(&b->pwmLock);
+  b->running = false;
+  b->stepsNum = 0;
+  b->pwmPeriod_usec = 0;
+  b->pwmDuty = 100;
+  b->val = 0;
+  b->pwmRunning = false;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+  hrtimer_setup(&b->timer, blinkTimerHandler, CLOCK_MONOTONIC,
+                HRTIMER_MODE_REL);
+  hrtimer_setup(&b->pwmTimer, blinkPwmTimerHandler, CLOCK_MONOTONIC,
+                HRTIMER_MODE_REL);
+#else
+  hrtimer_init(&b->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  b->timer.function = &blinkTimerHandler;
+  hrtimer_init(&b->pwmTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  b->pwmTimer.function = &blinkPwmTimerHandler;
+#endif
+  b->timersInitialized = true;
+
+  return gpioInit(&b->gpio);
+}
+
 void gpioFree(struct GpioBean *g) {
   if (g->desc != NULL && !IS_ERR(g->desc)) {
     gpiod_put(g->desc);
@@ -167,6 +329,17 @@ void gpioFreeDebounce(struct DebouncedGpioBean *d) {
   }
 }
 
+void gpioFreeBlink(struct BlinkGpioBean *b) {
+  if (b->timersInitialized) {
+    hrtimer_cancel(&b->timer);
+    b->running = false;
+    hrtimer_cancel(&b->pwmTimer);
+    b->pwmRunning = false;
+    b->timersInitialized = false;
+  }
+  gpioFree(&b->gpio);
+}
+
 int gpioGetVal(struct GpioBean *g) {
   int v;
   v = gpiod_get_value(g->desc);
@@ -251,9 +424,33 @@ ssize_t devAttrGpio_show(struct device *dev, struct device_attribute *attr,
   return valToStr(buf, gpioGetVal(g), vals, false, 0, 10, 0);
 }
 
+/*
+ * Parses a value written to an output, cur being its current value for
+ * flip/toggle. Returns the value or a negative error.
+ */
+static int64_t gpioParseVal(const char *buf, const char *vals, int cur) {
+  bool bVal;
+
+  if (vals != NULL) {
+    return strToVal(buf, vals, false, 10);
+  }
+  if (mkstrtobool(buf, &bVal) < 0) {
+    if (toUpper(buf[0]) == 'E') {  // Enable
+      bVal = true;
+    } else if (toUpper(buf[0]) == 'D') {  // Disable
+      bVal = false;
+    } else if (toUpper(buf[0]) == 'F' ||
+               toUpper(buf[0]) == 'T') {  // Flip/Toggle
+      bVal = cur == 1 ? false : true;
+    } else {
+      return -EINVAL;
+    }
+  }
+  return bVal ? 1 : 0;
+}
+
 ssize_t devAttrGpio_store(struct device *dev, struct device_attribute *attr,
                           const char *buf, size_t count) {
-  bool bVal;
   int64_t val;
   struct GpioBean *g;
   const char *vals = NULL;
@@ -265,25 +462,9 @@ ssize_t devAttrGpio_store(struct device *dev, struct device_attribute *attr,
     return -EPERM;
   }
 
-  if (vals == NULL) {
-    if (mkstrtobool(buf, &bVal) < 0) {
-      if (toUpper(buf[0]) == 'E') {  // Enable
-        bVal = true;
-      } else if (toUpper(buf[0]) == 'D') {  // Disable
-        bVal = false;
-      } else if (toUpper(buf[0]) == 'F' ||
-                 toUpper(buf[0]) == 'T') {  // Flip/Toggle
-        bVal = gpioGetVal(g) == 1 ? false : true;
-      } else {
-        return -EINVAL;
-      }
-    }
-    val = bVal ? 1 : 0;
-  } else {
-    val = strToVal(buf, vals, false, 10);
-    if (val < 0) {
-      return val;
-    }
+  val = gpioParseVal(buf, vals, gpioGetVal(g));
+  if (val < 0) {
+    return val;
   }
 
   gpioSetVal(g, val);
@@ -330,6 +511,298 @@ ssize_t devAttrGpioBlink_store(struct device *dev,
   return count;
 }
 
+/*
+ * Only for the devAttrGpioBlinkBean* attributes, whose bean must be the gpio
+ * member of a BlinkGpioBean.
+ */
+static struct BlinkGpioBean *gpioGetBlinkBean(struct device *dev,
+                                              struct device_attribute *attr) {
+  struct GpioBean *g;
+  const char *vals = NULL;
+  g = gpioGetBean(dev, attr, &vals);
+  if (g == NULL) {
+    return NULL;
+  }
+  return container_of(g, struct BlinkGpioBean, gpio);
+}
+
+/*
+ * Level of a blink output, which reads steady while the software PWM is
+ * switching it.
+ */
+ssize_t devAttrGpioBlinkBeanVal_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf) {
+  struct GpioBean *g;
+  struct BlinkGpioBean *b;
+  const char *vals = NULL;
+  g = gpioGetBean(dev, attr, &vals);
+  if (g == NULL) {
+    return -EFAULT;
+  }
+  b = container_of(g, struct BlinkGpioBean, gpio);
+  return valToStr(buf, READ_ONCE(b->val), vals, false, 0, 10, 0);
+}
+
+/*
+ * Sets the level of a blink output, stopping the running pattern if any.
+ */
+ssize_t devAttrGpioBlinkBeanVal_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count) {
+  int64_t val;
+  struct GpioBean *g;
+  struct BlinkGpioBean *b;
+  const char *vals = NULL;
+  g = gpioGetBean(dev, attr, &vals);
+  if (g == NULL) {
+    return -EFAULT;
+  }
+  b = container_of(g, struct BlinkGpioBean, gpio);
+  if (b->gpio.flags != GPIOD_OUT_HIGH && b->gpio.flags != GPIOD_OUT_LOW) {
+    return -EPERM;
+  }
+
+  val = gpioParseVal(buf, vals, READ_ONCE(b->val));
+  if (val < 0) {
+    return val;
+  }
+
+  mutex_lock(&b->lock);
+  hrtimer_cancel(&b->timer);
+  b->running = false;
+  blinkSetVal(b, val);
+  mutex_unlock(&b->lock);
+  return count;
+}
+
+ssize_t devAttrGpioBlinkBean_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf) {
+  ssize_t res;
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  mutex_lock(&b->lock);
+  if (READ_ONCE(b->running) && b->stepsNum == 2 && b->steps[0].val == 1 &&
+      b->steps[1].val == 0) {
+    res = sprintf(buf, "%u %u %ld\n", b->steps[0].time_msec,
+                  b->steps[1].time_msec, READ_ONCE(b->rep));
+  } else {
+    res = sprintf(buf, "0 0 0\n");
+  }
+  mutex_unlock(&b->lock);
+  return res;
+}
+
+/*
+ * Starts a blink pattern "<on> [<off> [<rep>]]" (ms, ms, repetitions, a
+ * negative rep repeats forever) and returns right away. A new pattern
+ * replaces the running one; "stop" or an on time of 0 stops it.
+ */
+ssize_t devAttrGpioBlinkBean_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count) {
+  long on = 0;
+  long off = 0;
+  long rep = 1;
+  char *end = NULL;
+  struct BlinkStep steps[2];
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  if (b->gpio.flags != GPIOD_OUT_HIGH && b->gpio.flags != GPIOD_OUT_LOW) {
+    return -EPERM;
+  }
+  if (!sysfs_streq(buf, "stop")) {
+    on = simple_strtol(buf, &end, 10);
+    if (++end < buf + count) {
+      off = simple_strtol(end, &end, 10);
+      if (++end < buf + count) {
+        rep = simple_strtol(end, NULL, 10);
+      }
+    }
+  }
+  if (off < 0) {
+    off = 0;
+  }
+  if (rep < 0) {
+    rep = BLINK_REP_INFINITE;
+  } else if (rep == 0) {
+    rep = 1;
+  }
+
+  steps[0].val = 1;
+  steps[0].time_msec = on;
+  steps[1].val = 0;
+  steps[1].time_msec = off;
+  blinkStart(b, steps, on > 0 ? 2 : 0, rep);
+
+  return count;
+}
+
+ssize_t devAttrGpioBlinkBeanPattern_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf) {
+  int i;
+  ssize_t res;
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  mutex_lock(&b->lock);
+  if (READ_ONCE(b->running)) {
+    res = sprintf(buf, "%ld", READ_ONCE(b->rep));
+    for (i = 0; i < b->stepsNum; i++) {
+      res += sprintf(buf + res, " %d:%u", b->steps[i].val,
+                     b->steps[i].time_msec);
+    }
+    res += sprintf(buf + res, "\n");
+  } else {
+    res = sprintf(buf, "0\n");
+  }
+  mutex_unlock(&b->lock);
+  return res;
+}
+
+/*
+ * Starts a pattern "<rep> <val>:<ms> [<val>:<ms> ...]" of up to
+ * BLINK_STEPS_MAX steps, each setting the output to <val> for <ms>, played
+ * <rep> times (forever if negative). A new pattern replaces the running one;
+ * "stop" stops it.
+ */
+ssize_t devAttrGpioBlinkBeanPattern_store(struct device *dev,
+                                          struct device_attribute *attr,
+                                          const char *buf, size_t count) {
+  int n;
+  int stepsNum = 0;
+  long rep = 0;
+  unsigned long totTime_msec = 0;
+  struct BlinkStep steps[BLINK_STEPS_MAX];
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  if (b->gpio.flags != GPIOD_OUT_HIGH && b->gpio.flags != GPIOD_OUT_LOW) {
+    return -EPERM;
+  }
+
+  if (!sysfs_streq(buf, "stop")) {
+    if (sscanf(buf, "%ld%n", &rep, &n) != 1) {
+      return -EINVAL;
+    }
+    buf = skip_spaces(buf + n);
+    while (*buf != '\0') {
+      if (stepsNum >= BLINK_STEPS_MAX) {
+        return -EINVAL;
+      }
+      if (sscanf(buf, "%d:%u%n", &steps[stepsNum].val,
+                 &steps[stepsNum].time_msec, &n) != 2 ||
+          steps[stepsNum].val < 0 || steps[stepsNum].val > 1) {
+        return -EINVAL;
+      }
+      totTime_msec += steps[stepsNum].time_msec;
+      stepsNum++;
+      buf = skip_spaces(buf + n);
+    }
+    // a pattern taking no time would keep the timer firing
+    if (stepsNum == 0 || totTime_msec == 0) {
+      return -EINVAL;
+    }
+    if (rep < 0) {
+      rep = BLINK_REP_INFINITE;
+    } else if (rep == 0) {
+      rep = 1;
+    }
+  }
+
+  blinkStart(b, steps, stepsNum, rep);
+
+  return count;
+}
+
+ssize_t devAttrGpioBlinkBeanTone_show(struct device *dev,
+                                      struct device_attribute *attr,
+                                      char *buf) {
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  if (b->pwmPeriod_usec == 0) {
+    return sprintf(buf, "0\n");
+  }
+  return sprintf(buf, "%lu\n", USEC_PER_SEC / b->pwmPeriod_usec);
+}
+
+/*
+ * Sets the frequency, in Hz, the output is switched at with a 50% duty
+ * cycle while on. 0 drives the output steadily.
+ */
+ssize_t devAttrGpioBlinkBeanTone_store(struct device *dev,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count) {
+  unsigned int val;
+  int ret;
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  ret = kstrtouint(buf, 10, &val);
+  if (ret < 0) {
+    return ret;
+  }
+  if (val > BLINK_TONE_FREQ_MAX) {
+    return -EINVAL;
+  }
+  if (val == 0) {
+    blinkSetPwm(b, 0, 100);
+  } else {
+    blinkSetPwm(b, USEC_PER_SEC / val, 50);
+  }
+  return count;
+}
+
+ssize_t devAttrGpioBlinkBeanBrightness_show(struct device *dev,
+                                            struct device_attribute *attr,
+                                            char *buf) {
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  return sprintf(buf, "%u\n", b->pwmDuty);
+}
+
+/*
+ * Sets the duty cycle, in percent, of the output while on.
+ */
+ssize_t devAttrGpioBlinkBeanBrightness_store(struct device *dev,
+                                             struct device_attribute *attr,
+                                             const char *buf, size_t count) {
+  unsigned int val;
+  int ret;
+  struct BlinkGpioBean *b;
+  b = gpioGetBlinkBean(dev, attr);
+  if (b == NULL) {
+    return -EFAULT;
+  }
+  ret = kstrtouint(buf, 10, &val);
+  if (ret < 0) {
+    return ret;
+  }
+  if (val > 100) {
+    return -EINVAL;
+  }
+  blinkSetPwm(b, BLINK_PWM_PERIOD_USEC, val);
+  return count;
+}
+
 static struct DebouncedGpioBean *gpioGetDebouncedBean(struct device *dev,
                                                struct device_attribute *attr) {
   struct GpioBean *g;
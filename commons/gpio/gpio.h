@@ -2,12 +2,20 @@
 #define _SL_GPIO_H
 
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/spinlock.h>
 #include <linux/version.h>
 
 #define DEBOUNCE_DEFAULT_TIME_USEC 50000ul
 #define DEBOUNCE_STATE_NOT_DEFINED -1
 
+#define BLINK_REP_INFINITE -1
+#define BLINK_STEPS_MAX 32
+#define BLINK_PWM_PERIOD_USEC 5000
+#define BLINK_TONE_FREQ_MAX 1000
+
 struct GpioBean {
   const char *name;
   struct gpio_desc *desc;
@@ -29,16 +37,44 @@ struct DebouncedGpioBean {
   struct kernfs_node *notifKn;
 };
 
+struct BlinkStep {
+  int val;
+  unsigned int time_msec;
+};
+
+struct BlinkGpioBean {
+  struct GpioBean gpio;
+  struct mutex lock;
+  struct hrtimer timer;
+  struct BlinkStep steps[BLINK_STEPS_MAX];
+  int stepsNum;
+  int step;
+  long rep;
+  bool running;
+  spinlock_t pwmLock;
+  struct hrtimer pwmTimer;
+  unsigned int pwmPeriod_usec;
+  unsigned int pwmDuty;
+  int val;
+  bool pwmHigh;
+  bool pwmRunning;
+  bool timersInitialized;
+};
+
 void gpioSetPlatformDev(struct platform_device *pdev);
 
 int gpioInit(struct GpioBean *g);
 
 int gpioInitDebounce(struct DebouncedGpioBean *d);
 
+int gpioInitBlink(struct BlinkGpioBean *b);
+
 void gpioFree(struct GpioBean *g);
 
 void gpioFreeDebounce(struct DebouncedGpioBean *d);
 
+void gpioFreeBlink(struct BlinkGpioBean *b);
+
 int gpioGetVal(struct GpioBean *g);
 
 void gpioSetVal(struct GpioBean *g, int val);
@@ -78,10 +114,47 @@ ssize_t devAttrGpioDebOnCnt_show(struct device *dev,
 ssize_t devAttrGpioDebOffCnt_show(struct device *dev,
                                   struct device_attribute *attr, char *buf);
 
+ssize_t devAttrGpioBlinkBeanVal_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf);
+
+ssize_t devAttrGpioBlinkBeanVal_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count);
+
 ssize_t devAttrGpioBlink_store(struct device *dev,
                                struct device_attribute *attr, const char *buf,
                                size_t count);
 
+ssize_t devAttrGpioBlinkBean_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf);
+
+ssize_t devAttrGpioBlinkBean_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count);
+
+ssize_t devAttrGpioBlinkBeanPattern_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf);
+
+ssize_t devAttrGpioBlinkBeanPattern_store(struct device *dev,
+                                          struct device_attribute *attr,
+                                          const char *buf, size_t count);
+
+ssize_t devAttrGpioBlinkBeanTone_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf);
+
+ssize_t devAttrGpioBlinkBeanTone_store(struct device *dev,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count);
+
+ssize_t devAttrGpioBlinkBeanBrightness_show(struct device *dev,
+                                            struct device_attribute *attr,
+                                            char *buf);
+
+ssize_t devAttrGpioBlinkBeanBrightness_store(struct device *dev,
+                                             struct device_attribute *attr,
+                                             const char *buf, size_t count);
+
 struct GpioBean *gpioGetBean(struct device *dev, struct device_attribute *attr,
                              const char **vals);
 
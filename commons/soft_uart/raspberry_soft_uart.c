@@ -1,30 +1,55 @@
 
 #include "raspberry_soft_uart.h"
 #include "queue.h"
+#include "ring.h"
+#include "../utils/utils.h"
 
+#include <linux/debugfs.h>
 #include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 #include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
 #include <linux/tty.h>
 #include <linux/tty_flip.h>
 #include <linux/version.h>
 
+#define CREATE_TRACE_POINTS
+#include "soft_uart_trace.h"
+
+// log2 buckets of sample offsets in ns, the last one also counts larger ones
+#define RX_SAMPLE_OFFSET_HIST_SIZE  24
+
 static irqreturn_t handle_rx_start(int irq, void *device);
 static enum hrtimer_restart handle_tx(struct hrtimer* timer);
 static enum hrtimer_restart handle_rx(struct hrtimer* timer);
 static void receive_character(unsigned char character);
+static void receive_error(int error);
+static ktime_t frame_time(ktime_t frame_start, unsigned int half_bits);
+static void record_rx_sample_offset(s64 offset);
 
 static struct queue queue_tx;
+static struct ring ring_rx;
 static struct tty_struct* current_tty = NULL;
 static DEFINE_MUTEX(current_tty_mutex);
 static struct hrtimer timer_tx;
 static struct hrtimer timer_rx;
-static ktime_t period;
-static ktime_t half_period;
+static unsigned int baud = 1200;
+static ktime_t tx_frame_start;
+static ktime_t rx_frame_start;
 static struct gpio_desc *gpio_tx;
 static struct gpio_desc *gpio_rx;
 static int rx_bit_index = -1;
-static void (*rx_callback)(unsigned char) = NULL;
+static s64 rx_frame_max_offset;
+static unsigned long rx_sample_offset_hist[RX_SAMPLE_OFFSET_HIST_SIZE];
+static unsigned long rx_framing_errors;
+static unsigned long rx_false_starts;
+typedef void (*rx_callback_t)(unsigned char);
+static rx_callback_t __rcu rx_callback = NULL;
+typedef void (*rx_error_callback_t)(int);
+static rx_error_callback_t __rcu rx_error_callback = NULL;
 
 /**
  * Initializes the Raspberry Soft UART infrastructure.
@@ -40,20 +65,21 @@ int raspberry_soft_uart_init(struct gpio_desc *_gpio_tx, struct gpio_desc *_gpio
   bool success = true;
   
   mutex_init(&current_tty_mutex);
+  initialize_ring(&ring_rx);
   
   // Initializes the TX timer.
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
-  hrtimer_setup(&timer_tx, handle_tx, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hrtimer_setup(&timer_tx, handle_tx, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
 #else
-  hrtimer_init(&timer_tx, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hrtimer_init(&timer_tx, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
   timer_tx.function = &handle_tx;
 #endif
   
   // Initializes the RX timer.
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
-  hrtimer_setup(&timer_rx, handle_rx, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hrtimer_setup(&timer_rx, handle_rx, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
 #else
-  hrtimer_init(&timer_rx, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hrtimer_init(&timer_rx, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
   timer_rx.function = &handle_rx;
 #endif
   
@@ -65,7 +91,7 @@ int raspberry_soft_uart_init(struct gpio_desc *_gpio_tx, struct gpio_desc *_gpio
   success &= request_irq(
     gpiod_to_irq(gpio_rx),
     handle_rx_start,
-    IRQF_TRIGGER_FALLING,
+    IRQF_TRIGGER_FALLING | IRQF_NO_THREAD,
     "soft_uart_irq_handler",
     NULL) == 0;
   disable_irq(gpiod_to_irq(gpio_rx));
@@ -97,7 +123,7 @@ int raspberry_soft_uart_open(struct tty_struct* tty)
   rx_bit_index = -1;
   if (current_tty == NULL)
   {
-    current_tty = tty;
+    WRITE_ONCE(current_tty, tty);
     initialize_queue(&queue_tx);
     success = 1;
     enable_irq(gpiod_to_irq(gpio_rx));
@@ -115,7 +141,8 @@ int raspberry_soft_uart_close(void)
   disable_irq(gpiod_to_irq(gpio_rx));
   hrtimer_cancel(&timer_tx);
   hrtimer_cancel(&timer_rx);
-  current_tty = NULL;
+  // The RX path is stopped, no receive_character() can see the old tty.
+  WRITE_ONCE(current_tty, NULL);
   mutex_unlock(&current_tty_mutex);
   return 1;
 }
@@ -127,8 +154,11 @@ int raspberry_soft_uart_close(void)
  */
 int raspberry_soft_uart_set_baudrate(const int baudrate) 
 {
-  period = ktime_set(0, 1000000000/baudrate);
-  half_period = ktime_set(0, 1000000000/baudrate/2);
+  if (baudrate <= 0)
+  {
+    return 0;
+  }
+  baud = baudrate;
   gpiod_set_debounce(gpio_rx, 1000/baudrate/2);
   return 1;
 }
@@ -146,7 +176,7 @@ int raspberry_soft_uart_send_string(const unsigned char* string, int string_size
   // Starts the TX timer if it is not already running.
   if (!hrtimer_active(&timer_tx))
   {
-    hrtimer_start(&timer_tx, period, HRTIMER_MODE_REL);
+    hrtimer_start(&timer_tx, frame_time(ktime_get(), 2), HRTIMER_MODE_ABS);
   }
   
   return result;
@@ -172,12 +202,120 @@ int raspberry_soft_uart_get_tx_queue_size(void)
 
 /**
  * Sets the callback function to be called on received character.
+ * When a callback is set, received characters are also stored in the RX ring,
+ * to be fetched with raspberry_soft_uart_read().
  * @param callback the callback function
  */
 int raspberry_soft_uart_set_rx_callback(void (*callback)(unsigned char))
 {
-	rx_callback = callback;
-	return 1;
+  rcu_assign_pointer(rx_callback, callback);
+  // Makes sure the RX path is no longer using the previous callback.
+  synchronize_rcu();
+  return 1;
+}
+
+/**
+ * Gets up to a given number of characters from the RX ring.
+ * Must be called by one consumer at a time.
+ * @param buffer destination buffer
+ * @param buffer_size size of the destination buffer
+ * @return The amount of characters fetched.
+ */
+int raspberry_soft_uart_read(unsigned char* buffer, int buffer_size)
+{
+  return ring_read(&ring_rx, buffer, buffer_size);
+}
+
+/**
+ * Discards all the characters in the RX ring.
+ * Must be called by the same consumer calling raspberry_soft_uart_read().
+ */
+void raspberry_soft_uart_flush_rx(void)
+{
+  ring_discard(&ring_rx);
+}
+
+/*
+ * Gets the number of characters in the RX ring.
+ * @return number of characters.
+ */
+int raspberry_soft_uart_get_rx_size(void)
+{
+  return get_ring_size(&ring_rx);
+}
+
+/*
+ * Gets the number of received characters dropped because the RX ring was full.
+ * @return number of characters.
+ */
+unsigned long raspberry_soft_uart_get_rx_overflows(void)
+{
+  return get_ring_overflows(&ring_rx);
+}
+
+/**
+ * Sets the callback function to be called on RX errors, i.e. a framing error
+ * (stop bit not high) or an overrun (RX ring full), with the error code.
+ * Called from the RX timer, hence it must not sleep.
+ * @param callback the callback function
+ */
+int raspberry_soft_uart_set_rx_error_callback(void (*callback)(int))
+{
+  rcu_assign_pointer(rx_error_callback, callback);
+  // Makes sure the RX path is no longer using the previous callback.
+  synchronize_rcu();
+  return 1;
+}
+
+/*
+ * Gets the number of received frames discarded because their stop bit was low.
+ * @return number of frames.
+ */
+unsigned long raspberry_soft_uart_get_rx_framing_errors(void)
+{
+  return READ_ONCE(rx_framing_errors);
+}
+
+/*
+ * Gets the number of falling edges discarded because the line was back high
+ * in the middle of the start bit.
+ * @return number of edges.
+ */
+unsigned long raspberry_soft_uart_get_rx_false_starts(void)
+{
+  return READ_ONCE(rx_false_starts);
+}
+
+static int rx_sample_offset_show(struct seq_file *s, void *unused)
+{
+  seq_puts(s, "max_offset_ns frames\n");
+  seqLog2Hist(s, rx_sample_offset_hist, RX_SAMPLE_OFFSET_HIST_SIZE);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rx_sample_offset);
+
+static int rx_errors_show(struct seq_file *s, void *unused)
+{
+  seq_printf(s, "framing_errors %lu\n", raspberry_soft_uart_get_rx_framing_errors());
+  seq_printf(s, "false_starts %lu\n", raspberry_soft_uart_get_rx_false_starts());
+  seq_printf(s, "overruns %lu\n", raspberry_soft_uart_get_rx_overflows());
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rx_errors);
+
+/**
+ * Creates the Soft UART debugfs entries.
+ * rx_sample_offset reports, per received frame, the worst delay of a sample
+ * from its scheduled time, as a log2 histogram.
+ * rx_errors reports the framing errors, false starts and overruns counters.
+ * @param parent debugfs directory where the "soft_uart" directory is created
+ */
+void raspberry_soft_uart_debugfs_init(struct dentry *parent)
+{
+  struct dentry *dir = debugfs_create_dir("soft_uart", parent);
+  debugfs_create_file("rx_sample_offset", 0444, dir, NULL,
+    &rx_sample_offset_fops);
+  debugfs_create_file("rx_errors", 0444, dir, NULL, &rx_errors_fops);
 }
 
 //-----------------------------------------------------------------------------
@@ -190,20 +328,39 @@ int raspberry_soft_uart_set_rx_callback(void (*callback)(unsigned char))
  */
 static irqreturn_t handle_rx_start(int irq, void *device)
 {
+  // Timestamped first thing in the hard IRQ, all samples derive from it.
+  ktime_t edge_time = ktime_get();
   if (rx_bit_index == -1)
   {
-    hrtimer_start(&timer_rx, half_period, HRTIMER_MODE_REL);
+    rx_frame_start = edge_time;
+    rx_frame_max_offset = 0;
+    // Samples the start bit in its middle.
+    hrtimer_start(&timer_rx, frame_time(rx_frame_start, 1), HRTIMER_MODE_ABS);
   }
   return IRQ_HANDLED;
 }
 
+/**
+ * Gets the time of a point in the current frame.
+ * Each offset is computed from the frame start, so the integer division
+ * error never exceeds 1 ns and does not accumulate over the frame bits.
+ * @param frame_start time of the start bit falling edge
+ * @param half_bits offset from the frame start, in half bit periods
+ * @return The absolute time.
+ */
+static ktime_t frame_time(ktime_t frame_start, unsigned int half_bits)
+{
+  return ktime_add_ns(frame_start,
+    div_u64((u64) half_bits * NSEC_PER_SEC, 2 * baud));
+}
+
 
 /**
  * Dequeues a character from the TX queue and sends it.
  */
 static enum hrtimer_restart handle_tx(struct hrtimer* timer)
 {
-  ktime_t current_time = ktime_get();
+  ktime_t next_time;
   static unsigned char character = 0;
   static int bit_index = -1;
   enum hrtimer_restart result = HRTIMER_NORESTART;
@@ -215,6 +372,8 @@ static enum hrtimer_restart handle_tx(struct hrtimer* timer)
     if (dequeue_character(&queue_tx, &character))
     {
       gpiod_set_value(gpio_tx, 0);
+      tx_frame_start = ktime_get();
+      trace_soft_uart_tx_frame_start(character);
       bit_index++;
       must_restart_timer = true;
     }
@@ -232,15 +391,19 @@ static enum hrtimer_restart handle_tx(struct hrtimer* timer)
   else if (bit_index == 8)
   {
     gpiod_set_value(gpio_tx, 1);
+    trace_soft_uart_tx_frame_stop(character);
     character = 0;
     bit_index = -1;
     must_restart_timer = get_queue_size(&queue_tx) > 0;
   }
   
-  // Restarts the TX timer.
+  // Restarts the TX timer at the next edge of the frame, or at the end of
+  // the stop bit for the next frame.
   if (must_restart_timer)
   {
-    hrtimer_forward(&timer_tx, current_time, period);
+    next_time = frame_time(tx_frame_start,
+      bit_index == -1 ? 20 : 2 * (bit_index + 1));
+    hrtimer_set_expires(&timer_tx, next_time);
     result = HRTIMER_RESTART;
   }
   
@@ -252,18 +415,33 @@ static enum hrtimer_restart handle_tx(struct hrtimer* timer)
  */
 static enum hrtimer_restart handle_rx(struct hrtimer* timer)
 {
-  ktime_t current_time = ktime_get();
+  ktime_t next_time;
   static unsigned int character = 0;
   int bit_value = gpiod_get_value(gpio_rx);
+  s64 offset = ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer)));
   enum hrtimer_restart result = HRTIMER_NORESTART;
   bool must_restart_timer = false;
   
-  // Start bit.
+  if (offset > rx_frame_max_offset)
+  {
+    rx_frame_max_offset = offset;
+  }
+  
+  // Start bit, sampled in its middle: if the line is already back high the
+  // falling edge was a glitch and we wait for the next one.
   if (rx_bit_index == -1)
   {
-    rx_bit_index++;
-    character = 0;
-    must_restart_timer = true;
+    if (bit_value == 0)
+    {
+      rx_bit_index++;
+      character = 0;
+      must_restart_timer = true;
+    }
+    else
+    {
+      WRITE_ONCE(rx_false_starts, rx_false_starts + 1);
+      trace_soft_uart_rx_error(SOFT_UART_RX_FALSE_START);
+    }
   }
   
   // Data bits.
@@ -283,47 +461,108 @@ static enum hrtimer_restart handle_rx(struct hrtimer* timer)
     must_restart_timer = true;
   }
   
-  // Stop bit.
+  // Stop bit, must be high or the frame is discarded.
   else if (rx_bit_index == 8)
   {
-    receive_character(character);
+    if (bit_value != 0)
+    {
+      trace_soft_uart_rx_char(character, rx_frame_start, rx_frame_max_offset);
+      receive_character(character);
+    }
+    else
+    {
+      WRITE_ONCE(rx_framing_errors, rx_framing_errors + 1);
+      receive_error(SOFT_UART_RX_FRAMING_ERROR);
+    }
+    record_rx_sample_offset(rx_frame_max_offset);
     rx_bit_index = -1;
   }
   
-  // Restarts the RX timer.
+  // Restarts the RX timer in the middle of the next bit.
   if (must_restart_timer)
   {
-    hrtimer_forward(&timer_rx, current_time, period);
+    next_time = frame_time(rx_frame_start, 2 * rx_bit_index + 3);
+    hrtimer_set_expires(&timer_rx, next_time);
     result = HRTIMER_RESTART;
   }
   
   return result;
 }
 
+/**
+ * Adds the worst sample offset of a frame to the histogram.
+ * @param offset offset in ns
+ */
+static void record_rx_sample_offset(s64 offset)
+{
+  int i = offset > 1 ? ilog2((u64) offset) : 0;
+  if (i >= RX_SAMPLE_OFFSET_HIST_SIZE)
+  {
+    i = RX_SAMPLE_OFFSET_HIST_SIZE - 1;
+  }
+  rx_sample_offset_hist[i]++;
+}
+
 /**
  * Adds a given (received) character to the RX buffer, which is managed by the kernel,
  * and then flushes (flip) it.
+ * Called from the RX timer, hence it must not sleep: the callback is published
+ * via RCU and current_tty is only changed while the RX path is stopped.
  * @param character given character
  */
-void receive_character(unsigned char character)
+static void receive_character(unsigned char character)
 {
-  mutex_lock(&current_tty_mutex);
-  if (rx_callback != NULL) {
-	  (*rx_callback)(character);
-  } else {
+  rx_callback_t callback;
+  struct tty_struct* tty;
+
+  rcu_read_lock();
+  callback = rcu_dereference(rx_callback);
+  if (callback != NULL)
+  {
+    if (ring_put(&ring_rx, character))
+    {
+      callback(character);
+    }
+    else
+    {
+      receive_error(SOFT_UART_RX_OVERRUN);
+    }
+  }
+  else
+  {
+    tty = READ_ONCE(current_tty);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
-    if (current_tty != NULL && current_tty->port != NULL)
+    if (tty != NULL && tty->port != NULL)
     {
-      tty_insert_flip_char(current_tty->port, character, TTY_NORMAL);
-      tty_flip_buffer_push(current_tty->port);
+      tty_insert_flip_char(tty->port, character, TTY_NORMAL);
+      tty_flip_buffer_push(tty->port);
     }
 #else
     if (tty != NULL)
     {
-      tty_insert_flip_char(current_tty, character, TTY_NORMAL);
+      tty_insert_flip_char(tty, character, TTY_NORMAL);
       tty_flip_buffer_push(tty);
     }
 #endif
   }
-  mutex_unlock(&current_tty_mutex);
+  rcu_read_unlock();
+}
+
+/**
+ * Reports an RX error to the RX error callback, if set.
+ * Called from the RX timer, hence it must not sleep.
+ * @param error error code
+ */
+static void receive_error(int error)
+{
+  rx_error_callback_t callback;
+
+  trace_soft_uart_rx_error(error);
+  rcu_read_lock();
+  callback = rcu_dereference(rx_error_callback);
+  if (callback != NULL)
+  {
+    callback(error);
+  }
+  rcu_read_unlock();
 }
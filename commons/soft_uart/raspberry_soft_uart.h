@@ -1,9 +1,15 @@
 #ifndef RASPBERRY_SOFT_UART_H
 #define RASPBERRY_SOFT_UART_H
 
+#include <linux/debugfs.h>
 #include <linux/tty.h>
 #include <linux/gpio/consumer.h>
 
+// RX errors, reported to the RX error callback and in the traces
+#define SOFT_UART_RX_FRAMING_ERROR  1
+#define SOFT_UART_RX_OVERRUN        2
+#define SOFT_UART_RX_FALSE_START    3
+
 int raspberry_soft_uart_init(struct gpio_desc *_gpio_tx, struct gpio_desc *_gpio_rx);
 int raspberry_soft_uart_finalize(void);
 int raspberry_soft_uart_open(struct tty_struct* tty);
@@ -13,5 +19,13 @@ int raspberry_soft_uart_send_string(const unsigned char* string, int string_size
 int raspberry_soft_uart_get_tx_queue_room(void);
 int raspberry_soft_uart_get_tx_queue_size(void);
 int raspberry_soft_uart_set_rx_callback(void (*callback)(unsigned char));
+int raspberry_soft_uart_read(unsigned char* buffer, int buffer_size);
+void raspberry_soft_uart_flush_rx(void);
+int raspberry_soft_uart_get_rx_size(void);
+unsigned long raspberry_soft_uart_get_rx_overflows(void);
+int raspberry_soft_uart_set_rx_error_callback(void (*callback)(int));
+unsigned long raspberry_soft_uart_get_rx_framing_errors(void);
+unsigned long raspberry_soft_uart_get_rx_false_starts(void);
+void raspberry_soft_uart_debugfs_init(struct dentry *parent);
 
 #endif
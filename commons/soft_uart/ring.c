@@ -0,0 +1,105 @@
+#include "ring.h"
+
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+
+#define RING_MASK  (RING_SIZE - 1)
+
+/**
+ * Initializes a given ring.
+ * Must not be called while a producer or a consumer is using the ring.
+ * @param ring given ring
+ */
+void initialize_ring(struct ring* ring)
+{
+  ring->head = 0;
+  ring->tail = 0;
+  ring->overflows = 0;
+}
+
+/**
+ * Adds a given character into a given ring. Producer side only.
+ * @param ring given ring
+ * @param character given character
+ * @return 1 if the character is added to the ring. 0 if the ring is full.
+ */
+int ring_put(struct ring* ring, const unsigned char character)
+{
+  unsigned int head = ring->head;
+  unsigned int tail = smp_load_acquire(&ring->tail);
+  if (head - tail >= RING_SIZE)
+  {
+    WRITE_ONCE(ring->overflows, ring->overflows + 1);
+    return 0;
+  }
+  ring->data[head & RING_MASK] = character;
+  // Publishes the character before the new head.
+  smp_store_release(&ring->head, head + 1);
+  return 1;
+}
+
+/**
+ * Gets a character from a given ring. Consumer side only.
+ * @param ring given ring
+ * @param character a character
+ * @return 1 if a character is fetched from the ring. 0 if the ring is empty.
+ */
+int ring_get(struct ring* ring, unsigned char* character)
+{
+  unsigned int tail = ring->tail;
+  unsigned int head = smp_load_acquire(&ring->head);
+  if (head == tail)
+  {
+    return 0;
+  }
+  *character = ring->data[tail & RING_MASK];
+  // Releases the slot only after the character has been read.
+  smp_store_release(&ring->tail, tail + 1);
+  return 1;
+}
+
+/**
+ * Gets up to a given number of characters from a given ring.
+ * Consumer side only.
+ * @param ring given ring
+ * @param buffer destination buffer
+ * @param buffer_size size of the destination buffer
+ * @return The amount of characters fetched from the ring.
+ */
+int ring_read(struct ring* ring, unsigned char* buffer, int buffer_size)
+{
+  int n = 0;
+  while (n < buffer_size && ring_get(ring, &buffer[n]))
+  {
+    n++;
+  }
+  return n;
+}
+
+/**
+ * Discards all the characters contained in a given ring.
+ * Consumer side only.
+ * @param ring given ring
+ */
+void ring_discard(struct ring* ring)
+{
+  smp_store_release(&ring->tail, smp_load_acquire(&ring->head));
+}
+
+/**
+ * Gets the number of characters contained in a given ring.
+ * @return number of characters.
+ */
+int get_ring_size(struct ring* ring)
+{
+  return smp_load_acquire(&ring->head) - READ_ONCE(ring->tail);
+}
+
+/**
+ * Gets the number of characters dropped because the ring was full.
+ * @return number of characters.
+ */
+unsigned long get_ring_overflows(struct ring* ring)
+{
+  return READ_ONCE(ring->overflows);
+}
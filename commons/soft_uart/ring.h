@@ -0,0 +1,27 @@
+#ifndef RING_H
+#define RING_H
+
+#define RING_SIZE  256  // must be a power of two
+
+/*
+ * Single-producer/single-consumer lock-free ring buffer.
+ * head is only written by the producer, tail only by the consumer.
+ */
+struct ring
+{
+  unsigned int head;
+  unsigned int tail;
+  unsigned long overflows;
+  unsigned char data[RING_SIZE];
+};
+
+
+void initialize_ring(struct ring* ring);
+int  ring_put(struct ring* ring, const unsigned char character);
+int  ring_get(struct ring* ring, unsigned char* character);
+int  ring_read(struct ring* ring, unsigned char* buffer, int buffer_size);
+void ring_discard(struct ring* ring);
+int  get_ring_size(struct ring* ring);
+unsigned long get_ring_overflows(struct ring* ring);
+
+#endif
@@ -0,0 +1,80 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM soft_uart
+
+#if !defined(SOFT_UART_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SOFT_UART_TRACE_H
+
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(soft_uart_tx_frame,
+  TP_PROTO(unsigned char character),
+  TP_ARGS(character),
+  TP_STRUCT__entry(
+    __field(unsigned char, character)
+  ),
+  TP_fast_assign(
+    __entry->character = character;
+  ),
+  TP_printk("char=0x%02x", __entry->character)
+);
+
+/*
+ * TX frame start: emitted when the start bit edge is driven.
+ */
+DEFINE_EVENT(soft_uart_tx_frame, soft_uart_tx_frame_start,
+  TP_PROTO(unsigned char character),
+  TP_ARGS(character)
+);
+
+/*
+ * TX frame stop: emitted when the stop bit edge is driven.
+ */
+DEFINE_EVENT(soft_uart_tx_frame, soft_uart_tx_frame_stop,
+  TP_PROTO(unsigned char character),
+  TP_ARGS(character)
+);
+
+/*
+ * RX character received, with the time of its start bit edge and the
+ * worst delay of its samples from their nominal time.
+ */
+TRACE_EVENT(soft_uart_rx_char,
+  TP_PROTO(unsigned char character, ktime_t frame_start, s64 max_offset),
+  TP_ARGS(character, frame_start, max_offset),
+  TP_STRUCT__entry(
+    __field(unsigned char, character)
+    __field(s64, frame_start_ns)
+    __field(s64, max_offset_ns)
+  ),
+  TP_fast_assign(
+    __entry->character = character;
+    __entry->frame_start_ns = ktime_to_ns(frame_start);
+    __entry->max_offset_ns = max_offset;
+  ),
+  TP_printk("char=0x%02x frame_start_ns=%lld max_offset_ns=%lld",
+    __entry->character, __entry->frame_start_ns, __entry->max_offset_ns)
+);
+
+/*
+ * RX error, see the SOFT_UART_RX_* error codes.
+ */
+TRACE_EVENT(soft_uart_rx_error,
+  TP_PROTO(int error),
+  TP_ARGS(error),
+  TP_STRUCT__entry(
+    __field(int, error)
+  ),
+  TP_fast_assign(
+    __entry->error = error;
+  ),
+  TP_printk("error=%d", __entry->error)
+);
+
+#endif /* SOFT_UART_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE soft_uart_trace
+#include <trace/define_trace.h>
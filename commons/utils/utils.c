@@ -132,3 +132,26 @@ int64_t strToVal(const char *buf, const char *vals, bool sign, uint8_t base) {
 
   return val & 0xffffffff;
 }
+
+/*
+ * Prints a log2 histogram, one "<max value> <count>" line per bucket up to
+ * the last non-empty one. Bucket i counts the values up to 2^(i+1)-1, the
+ * last one also counts all the larger values and is printed as ">=<min>".
+ */
+void seqLog2Hist(struct seq_file *s, const unsigned long *hist, int size) {
+  char label[24];
+  int i, last = -1;
+  for (i = 0; i < size; i++) {
+    if (hist[i] > 0) {
+      last = i;
+    }
+  }
+  for (i = 0; i <= last; i++) {
+    if (i < size - 1) {
+      snprintf(label, sizeof(label), "%lu", (2ul << i) - 1);
+    } else {
+      snprintf(label, sizeof(label), ">=%lu", 1ul << i);
+    }
+    seq_printf(s, "%13s %lu\n", label, hist[i]);
+  }
+}
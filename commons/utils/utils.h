@@ -1,6 +1,7 @@
 #ifndef _SL_UTILS_H
 #define _SL_UTILS_H
 
+#include <linux/seq_file.h>
 #include <linux/time.h>
 
 unsigned long long to_usec(struct timespec64 *t);
@@ -9,5 +10,6 @@ char toUpper(char c);
 int valToStr(char *buf, int64_t val, const char *vals, bool sign, uint8_t len,
              uint8_t base, uint32_t mask);
 int64_t strToVal(const char *buf, const char *vals, bool sign, uint8_t base);
+void seqLog2Hist(struct seq_file *s, const unsigned long *hist, int size);
 
 #endif
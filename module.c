@@ -13,19 +13,39 @@
  *
  */
 
+#include <linux/completion.h>
+#include <linux/crc32.h>
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/firmware.h>
 #include <linux/fs.h>
 #include <linux/gpio.h>
+#include <linux/hrtimer.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/of.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/watchdog.h>
 
 #include "commons/soft_uart/raspberry_soft_uart.h"
 #include "commons/atecc/atecc.h"
 #include "commons/utils/utils.h"
 #include "commons/gpio/gpio.h"
 
+#define CREATE_TRACE_POINTS
+#include "stratopi_trace.h"
+
 #define MODEL_BASE		1
 #define MODEL_UPS		2
 #define MODEL_CAN		3
@@ -36,12 +56,42 @@
 #define MODEL_CAN_2		8
 #define MODEL_CM_2		9
 
+#define MODEL_MASK(m)	(1u << (m))
+#define MODELS_ALL		(~0u)
+#define MODELS_CM		(MODEL_MASK(MODEL_CM) | MODEL_MASK(MODEL_CMDUO) \
+						| MODEL_MASK(MODEL_CM_2))
+#define MODELS_CM_EXP	(MODEL_MASK(MODEL_CMDUO) | MODEL_MASK(MODEL_CM_2))
+#define MODELS_CAN		(MODEL_MASK(MODEL_CAN) | MODEL_MASK(MODEL_CAN_2))
+#define MODELS_UPS		(MODEL_MASK(MODEL_UPS) | MODEL_MASK(MODEL_UPS_3))
+#define MODELS_SEC_EL	(MODELS_ALL & ~(MODEL_MASK(MODEL_BASE) \
+						| MODEL_MASK(MODEL_UPS) | MODEL_MASK(MODEL_CAN) \
+						| MODEL_MASK(MODEL_CM)))
+#define MODELS_FW_INSTALL	(MODEL_MASK(MODEL_CMDUO) | MODEL_MASK(MODEL_UPS_3) \
+						| MODEL_MASK(MODEL_BASE_3) | MODEL_MASK(MODEL_CAN_2) \
+						| MODEL_MASK(MODEL_CM_2))
+
 #define SOFT_UART_RX_BUFF_SIZE 	100
+#define SOFT_UART_BAUD 	1200
+
+#define MCU_QUEUE_TIMEOUT_MS 	5000
+
+#define MCU_CACHE_SIZE 	24
+#define MCU_CACHE_VAL_LEN 	12
+#define MCU_CACHE_TTL_MS_DEFAULT 	0
+
+#define MCU_CONFIG_ATTRS_MAX 	24
+
+#define WDT_LIVENESS_DEADLINE_MS_DEFAULT 	10000
+
+#define MCU_STATS_SIZE 	32
+#define MCU_LATENCY_HIST_SIZE 	24
 
 #define FW_MAX_SIZE 16000
+#define FW_BLOCK_SIZE 64
+#define FW_BLOCK_TRIES 3
 
-#define FW_MAX_DATA_BYTES_PER_LINE 0x20
-#define FW_MAX_LINE_LEN (FW_MAX_DATA_BYTES_PER_LINE * 2 + 12)
+#define FW_HEX_MAX_RECORD_LEN (5 + 255)
+#define FW_IMAGE_MAGIC "SPFW"
 
 #define LOG_TAG "stratopi: "
 
@@ -58,77 +108,52 @@ static int model_num_fallback = -1;
 module_param( model_num_fallback, int, S_IRUGO);
 MODULE_PARM_DESC(model_num_fallback, " Strato Pi model number auto-detect fail fallback");
 
+static bool fw_install_diff = false;
+module_param( fw_install_diff, bool, S_IRUGO);
+MODULE_PARM_DESC(fw_install_diff, " Skip firmware blocks already matching the installed ones");
+
+static bool nowayout = WATCHDOG_NOWAYOUT;
+module_param( nowayout, bool, S_IRUGO);
+MODULE_PARM_DESC(nowayout, " Watchdog device cannot be stopped once started");
+
 static struct class *pDeviceClass;
+static struct dentry *pDebugfsDir;
+
+struct DeviceAttrBean {
+	struct device_attribute devAttr;
+	unsigned int models;
+};
+
+struct GpioAttrBean {
+	struct DeviceAttrBean attr;
+	struct GpioBean *gpio;
+};
+
+/*
+ * MCU parameter descriptor. The value written is validated against the
+ * min-max range if max > 0, or against the allowed characters in vals
+ * if set, and left-padded with zeros to respLen - strlen(cmd) characters.
+ */
+struct McuAttrBean {
+	struct DeviceAttrBean attr;
+	const char *cmd;
+	int respLen;
+	long min;
+	long max;
+	const char *vals;
+	bool persistent;
+};
+
+struct DeviceBean {
+	const char *name;
+	unsigned int models;
+	struct device *device;
+	struct DeviceAttrBean **attrs;
+};
 
-static struct device *pBuzzerDevice = NULL;
-static struct device *pWatchdogDevice = NULL;
-static struct device *pRs485Device = NULL;
-static struct device *pPowerDevice = NULL;
-static struct device *pUpsDevice = NULL;
-static struct device *pRelayDevice = NULL;
-static struct device *pLedDevice = NULL;
-static struct device *pButtonDevice = NULL;
-static struct device *pExpBusDevice = NULL;
-static struct device *pSdDevice = NULL;
-static struct device *pUsb1Device = NULL;
-static struct device *pUsb2Device = NULL;
-static struct device *pMcuDevice = NULL;
-static struct device *pSecElDevice = NULL;
-
-static struct device_attribute devAttrBuzzerStatus;
-static struct device_attribute devAttrBuzzerBeep;
-
-static struct device_attribute devAttrWatchdogEnabled;
-static struct device_attribute devAttrWatchdogHeartbeat;
-static struct device_attribute devAttrWatchdogExpired;
-static struct device_attribute devAttrWatchdogEnableMode;
-static struct device_attribute devAttrWatchdogTimeout;
-static struct device_attribute devAttrWatchdogDownDelay;
-static struct device_attribute devAttrWatchdogSdSwitch;
-
-static struct device_attribute devAttrRs485Mode;
-static struct device_attribute devAttrRs485Params;
-
-static struct device_attribute devAttrPowerDownEnabled;
-static struct device_attribute devAttrPowerDownDelay;
-static struct device_attribute devAttrPowerDownEnableMode;
-static struct device_attribute devAttrPowerOffTime;
-static struct device_attribute devAttrPowerUpDelay;
-static struct device_attribute devAttrPowerUpMode;
-static struct device_attribute devAttrPowerSdSwitch;
-
-static struct device_attribute devAttrUpsBattery;
-static struct device_attribute devAttrUpsPowerDelay;
-
-static struct device_attribute devAttrRelayStatus;
-
-static struct device_attribute devAttrLedStatus;
-static struct device_attribute devAttrLedBlink;
-
-static struct device_attribute devAttrButtonStatus;
-static struct device_attribute devAttrButtonStatusDeb;
-static struct device_attribute devAttrButtonStatusDebMs;
-static struct device_attribute devAttrButtonStatusDebCnt;
-
-static struct device_attribute devAttrExpBusEnabled;
-static struct device_attribute devAttrExpBusAux;
-
-static struct device_attribute devAttrSdSdxEnabled;
-static struct device_attribute devAttrSdSd1Enabled;
-static struct device_attribute devAttrSdSdxRouting;
-static struct device_attribute devAttrSdSdxDefault;
-
-static struct device_attribute devAttrUsb1Disabled;
-static struct device_attribute devAttrUsb1Ok;
-
-static struct device_attribute devAttrUsb2Disabled;
-static struct device_attribute devAttrUsb2Ok;
-
-static struct device_attribute devAttrMcuConfig;
-static struct device_attribute devAttrMcuFwVersion;
-static struct device_attribute devAttrMcuFwInstall;
-static struct device_attribute devAttrMcuFwInstallProgress;
-static struct device_attribute devAttrSecElSerialNum;
+static struct McuAttrBean devAttrMcuConfig;
+static struct McuAttrBean devAttrMcuFwVersion;
+static struct DeviceBean devMcu;
 
 static const char *stratopi_gp22 = "stratopi_gp22";
 static const char *stratopi_gp27 = "stratopi_gp27";
@@ -156,10 +181,86 @@ static const char *stratopi_gp26 = "stratopi_gp26";
 static const char *stratopi_gp13 = "stratopi_gp13";
 static const char *stratopi_gp19 = "stratopi_gp19";
 
-static DEFINE_MUTEX(mcuMutex);
+static DEFINE_MUTEX(fwMutex);
+
+struct McuRequest {
+	struct list_head list;
+	int (*run)(struct McuRequest *req);
+	const char *cmd;
+	int cmdLen;
+	int respLen;
+	int timeout;
+	int cachePrefixLen;
+	char resp[SOFT_UART_RX_BUFF_SIZE];
+	int result;
+	struct completion done;
+};
+
+static LIST_HEAD(mcuQueue);
+static DEFINE_SPINLOCK(mcuQueueLock);
+static DECLARE_WAIT_QUEUE_HEAD(mcuQueueWq);
+static struct task_struct *mcuWorkerTask = NULL;
 
-static struct GpioBean gpioBuzzer = {
-	.flags = GPIOD_OUT_LOW,
+struct McuCacheEntry {
+	char prefix[5];
+	char val[MCU_CACHE_VAL_LEN];
+	unsigned long stamp;
+	bool valid;
+};
+
+struct McuStats {
+	char prefix[4];
+	unsigned long count;
+	unsigned long errors;
+	unsigned long retries;
+	unsigned long timeouts;
+	unsigned long txBytes;
+	unsigned long rxBytes;
+	unsigned long latencyHist[MCU_LATENCY_HIST_SIZE];
+};
+
+static struct McuStats mcuStats[MCU_STATS_SIZE];
+static DEFINE_SPINLOCK(mcuStatsLock);
+
+static struct McuCacheEntry mcuCache[MCU_CACHE_SIZE];
+static DEFINE_SPINLOCK(mcuCacheLock);
+static unsigned int mcuCacheTtlMs = MCU_CACHE_TTL_MS_DEFAULT;
+
+struct McuConfigAttr {
+	struct DeviceBean *db;
+	struct McuAttrBean *ma;
+};
+
+static struct McuConfigAttr mcuConfigAttrs[MCU_CONFIG_ATTRS_MAX];
+static int mcuConfigAttrsNum;
+
+struct McuConfigBatch {
+	struct McuRequest req;
+	char vals[MCU_CONFIG_ATTRS_MAX][MCU_CACHE_VAL_LEN];
+};
+
+struct McuConfigApplyEntry {
+	int attrIdx;
+	char val[MCU_CACHE_VAL_LEN];
+	char old[MCU_CACHE_VAL_LEN];
+	const char *status;
+};
+
+struct McuConfigApply {
+	struct McuRequest req;
+	struct McuConfigApplyEntry entries[MCU_CONFIG_ATTRS_MAX];
+	int num;
+	bool save;
+	const char *saveStatus;
+};
+
+static struct McuConfigApply mcuConfigApply;
+static DEFINE_MUTEX(mcuConfigApplyMutex);
+
+static struct BlinkGpioBean gpioBuzzer = {
+	.gpio = {
+		.flags = GPIOD_OUT_LOW,
+	},
 };
 
 static struct GpioBean gpioWatchdogEnable = {
@@ -190,8 +291,10 @@ static struct GpioBean gpioRelay = {
 	.flags = GPIOD_OUT_LOW,
 };
 
-static struct GpioBean gpioLed = {
-	.flags = GPIOD_OUT_LOW,
+static struct BlinkGpioBean gpioLed = {
+	.gpio = {
+		.flags = GPIOD_OUT_LOW,
+	},
 };
 
 static struct DebouncedGpioBean gpioButton = {
@@ -233,1068 +336,2689 @@ static struct GpioBean gpioSoftSerRx = {
 };
 
 static bool softUartInitialized;
-static volatile char softUartRxBuff[SOFT_UART_RX_BUFF_SIZE];
-static volatile int softUartRxBuffIdx;
+static char softUartResp[SOFT_UART_RX_BUFF_SIZE];
+static int softUartRespLen;
+static int softUartRxExpected;
+static bool softUartRxError;
+static DECLARE_COMPLETION(softUartRxDone);
 
 static int fwVerMaj = 4;
 static int fwVerMin = 0;
-static uint8_t fwBytes[FW_MAX_SIZE];
+static uint8_t *fwBytes = NULL;
 static int fwMaxAddr = 0;
-static char fwLine[FW_MAX_LINE_LEN];
-static int fwLineIdx = 0;
+
+static struct {
+	bool inRecord;
+	bool lowNibble;
+	int len;
+	u32 baseAddr;
+	uint8_t rec[FW_HEX_MAX_RECORD_LEN];
+} fwHex;
 static volatile int fwProgress = 0;
+static bool fwInstalling = false;
+
+enum FwState {
+	FW_STATE_IDLE,
+	FW_STATE_STAGED,
+	FW_STATE_FLASHING,
+	FW_STATE_VALIDATING,
+	FW_STATE_DONE,
+	FW_STATE_ERROR,
+};
+
+static const char *fwStateNames[] = {
+	[FW_STATE_IDLE] = "idle",
+	[FW_STATE_STAGED] = "staged",
+	[FW_STATE_FLASHING] = "flashing",
+	[FW_STATE_VALIDATING] = "validating",
+	[FW_STATE_DONE] = "done",
+	[FW_STATE_ERROR] = "error",
+};
+
+static enum FwState fwState = FW_STATE_IDLE;
+
+static struct {
+	int written;
+	int skipped;
+	int retried;
+} fwStats;
+
+static struct McuRequest fwInstallReq;
+
+/*
+ * Header of a binary firmware image, followed by length bytes of flash
+ * content starting at address 0. crc is the CRC-32 of the content.
+ */
+struct FwImageHeader {
+	char magic[4];
+	u8 model;
+	u8 reserved[3];
+	__le32 length;
+	__le32 crc;
+} __packed;
 
 static bool startsWith(const char *str, const char *pre) {
 	return strncmp(pre, str, strlen(pre)) == 0;
 }
 
-static bool mcuMutexLock(void) {
-	uint8_t i;
-	for (i = 0; i < 20; i++) {
-		if (mutex_trylock(&mcuMutex)) {
-			return true;
+struct GpioBean* gpioGetBean(struct device *dev, struct device_attribute *attr,
+                             const char **vals) {
+	return container_of(attr, struct GpioAttrBean, attr.devAttr)->gpio;
+}
+
+static struct McuAttrBean* mcuAttrGet(struct device_attribute *attr) {
+	return container_of(attr, struct McuAttrBean, attr.devAttr);
+}
+
+static int mcuAttrRespLen(struct McuAttrBean *ma) {
+	if (ma == &devAttrMcuFwVersion && fwVerMaj == 3) {
+		// model code not returned
+		return 6;
+	}
+	return ma->respLen;
+}
+
+/*
+ * Validates the len characters of val for the given parameter and writes
+ * to out the value to be sent to the MCU, zero padded to its fixed length.
+ * Returns the value length or -EINVAL.
+ */
+static int mcuAttrFormatVal(struct McuAttrBean *ma, const char *val,
+		size_t len, char *out) {
+	int i;
+	long l;
+	int valLen = ma->respLen - strlen(ma->cmd);
+	int padd = valLen - len;
+
+	if (len < 1 || padd < 0) {
+		return -EINVAL;
+	}
+	for (i = 0; i < padd; i++) {
+		out[i] = '0';
+	}
+	for (i = 0; i < len; i++) {
+		if (!isalnum(val[i])) {
+			return -EINVAL;
 		}
-		msleep(1);
+		out[padd + i] = toUpper(val[i]);
 	}
-	return false;
+	out[valLen] = '\0';
+
+	if (ma->vals != NULL
+			&& (valLen != 1 || strchr(ma->vals, out[0]) == NULL)) {
+		return -EINVAL;
+	}
+	if (ma->max > 0
+			&& (kstrtol(out, 10, &l) < 0 || l < ma->min || l > ma->max)) {
+		return -EINVAL;
+	}
+	return valLen;
 }
 
-struct GpioBean* gpioGetBean(struct device *dev, struct device_attribute *attr,
-                             const char **vals) {
-	if (dev == pBuzzerDevice) {
-		return &gpioBuzzer;
-	} else if (dev == pWatchdogDevice) {
-		if (attr == &devAttrWatchdogEnabled) {
-			return &gpioWatchdogEnable;
-		} else if (attr == &devAttrWatchdogHeartbeat) {
-			return &gpioWatchdogHeartbeat;
-		} else if (attr == &devAttrWatchdogExpired) {
-			return &gpioWatchdogExpired.gpio;
-		}
-	} else if (dev == pPowerDevice) {
-		return &gpioShutdown;
-	} else if (dev == pUpsDevice) {
-		return &gpioUpsBattery.gpio;
-	} else if (dev == pRelayDevice) {
-		return &gpioRelay;
-	} else if (dev == pLedDevice) {
-		return &gpioLed;
-	} else if (dev == pButtonDevice) {
-		return &gpioButton.gpio;
-	} else if (dev == pExpBusDevice) {
-		if (attr == &devAttrExpBusEnabled) {
-			return &gpioI2cExpEnable;
-		} else if (attr == &devAttrExpBusAux) {
-			return &gpioI2cExpFeedback;
-		}
-	} else if (dev == pUsb1Device) {
-		if (attr == &devAttrUsb1Disabled) {
-			return &gpioUsb1Disable;
-		} else if (attr == &devAttrUsb1Ok) {
-			return &gpioUsb1Fault;
-		}
-	} else if (dev == pUsb2Device) {
-		if (attr == &devAttrUsb2Disabled) {
-			return &gpioUsb2Disable;
-		} else if (attr == &devAttrUsb2Ok) {
-			return &gpioUsb2Fault;
+static void softUartRxCallback(unsigned char character) {
+	// pairs with smp_mb() in softUartWaitResp()
+	smp_mb();
+	if (raspberry_soft_uart_get_rx_size() >= READ_ONCE(softUartRxExpected)) {
+		complete(&softUartRxDone);
+	}
+}
+
+/*
+ * A corrupted frame makes the response unusable: wakes up the waiting
+ * transaction so that it can be retried right away.
+ */
+static void softUartRxErrorCallback(int error) {
+	WRITE_ONCE(softUartRxError, true);
+	complete(&softUartRxDone);
+}
+
+static void softUartReadResp(void) {
+	unsigned char c;
+	while (softUartRespLen < SOFT_UART_RX_BUFF_SIZE - 1
+			&& raspberry_soft_uart_read(&c, 1) == 1) {
+		if (softUartRespLen == 0 && c != 'X') {
+			// every MCU response starts with 'X', drop leading noise
+			continue;
 		}
+		softUartResp[softUartRespLen++] = c;
 	}
-	return NULL;
+	softUartResp[softUartRespLen] = '\0';
 }
 
-static int getMcuCmd(struct device *dev, struct device_attribute *attr,
-		char *cmd) {
-	if (dev == pRs485Device) {
-		if (attr == &devAttrRs485Mode) {
-			cmd[1] = 'S';
-			cmd[2] = 'M';
-			return 4;
-		} else if (attr == &devAttrRs485Params) {
-			cmd[1] = 'S';
-			cmd[2] = 'P';
-			return 7;
-		}
-	} else if (dev == pPowerDevice) {
-		if (attr == &devAttrPowerDownEnableMode) {
-			cmd[1] = 'P';
-			cmd[2] = 'E';
-			return 4;
-		} else if (attr == &devAttrPowerDownDelay) {
-			cmd[1] = 'P';
-			cmd[2] = 'W';
-			return 8;
-		} else if (attr == &devAttrPowerOffTime) {
-			cmd[1] = 'P';
-			cmd[2] = 'O';
-			return 8;
-		} else if (attr == &devAttrPowerUpDelay) {
-			cmd[1] = 'P';
-			cmd[2] = 'U';
-			return 8;
-		} else if (attr == &devAttrPowerUpMode) {
-			cmd[1] = 'P';
-			cmd[2] = 'P';
-			return 4;
-		} else if (attr == &devAttrPowerSdSwitch) {
-			cmd[1] = 'P';
-			cmd[2] = 'S';
-			cmd[3] = 'D';
-			return 5;
-		}
-	} else if (dev == pWatchdogDevice) {
-		if (attr == &devAttrWatchdogEnableMode) {
-			cmd[1] = 'W';
-			cmd[2] = 'E';
-			return 4;
-		} else if (attr == &devAttrWatchdogTimeout) {
-			cmd[1] = 'W';
-			cmd[2] = 'H';
-			return 8;
-		} else if (attr == &devAttrWatchdogDownDelay) {
-			cmd[1] = 'W';
-			cmd[2] = 'W';
-			return 8;
-		} else if (attr == &devAttrWatchdogSdSwitch) {
-			cmd[1] = 'W';
-			cmd[2] = 'S';
-			cmd[3] = 'D';
-			return 5;
-		}
-	} else if (dev == pUpsDevice) {
-		if (attr == &devAttrUpsPowerDelay) {
-			cmd[1] = 'U';
-			cmd[2] = 'B';
-			return 8;
-		}
-	} else if (dev == pSdDevice) {
-		if (attr == &devAttrSdSdxEnabled) {
-			cmd[1] = 'S';
-			cmd[2] = 'D';
-			cmd[3] = '0';
-			return 5;
-		} else if (attr == &devAttrSdSd1Enabled) {
-			cmd[1] = 'S';
-			cmd[2] = 'D';
-			cmd[3] = '1';
-			return 5;
-		} else if (attr == &devAttrSdSdxRouting) {
-			cmd[1] = 'S';
-			cmd[2] = 'D';
-			cmd[3] = 'R';
-			return 5;
-		} else if (attr == &devAttrSdSdxDefault) {
-			cmd[1] = 'S';
-			cmd[2] = 'D';
-			cmd[3] = 'P';
-			return 5;
-		}
-	} else if (dev == pMcuDevice) {
-		if (attr == &devAttrMcuConfig) {
-			cmd[1] = 'C';
-			cmd[2] = 'C';
-			return 4;
-		} else if (attr == &devAttrMcuFwVersion) {
-			cmd[1] = 'F';
-			cmd[2] = 'W';
-			return fwVerMaj == 3 ? 6 : 9;
+static void softUartWaitResp(int respLen, int timeout) {
+	unsigned long deadline = jiffies + msecs_to_jiffies(timeout);
+	long left;
+
+	while (true) {
+		softUartReadResp();
+		if (softUartRespLen >= respLen || READ_ONCE(softUartRxError)) {
+			return;
+		}
+		left = (long) (deadline - jiffies);
+		if (left <= 0) {
+			return;
+		}
+		reinit_completion(&softUartRxDone);
+		WRITE_ONCE(softUartRxExpected, respLen - softUartRespLen);
+		smp_mb();
+		if (raspberry_soft_uart_get_rx_size() < softUartRxExpected) {
+			// woken up by softUartRxCallback() as soon as enough bytes are in
+			wait_for_completion_timeout(&softUartRxDone, left);
 		}
 	}
-	return -1;
 }
 
-static void softUartRxCallback(unsigned char character) {
-	if (softUartRxBuffIdx < SOFT_UART_RX_BUFF_SIZE - 1) {
-		softUartRxBuff[softUartRxBuffIdx++] = character;
+/*
+ * Accounts a transaction in the statistics of its command prefix, i.e.
+ * its first 3 characters.
+ */
+static void mcuStatsRecord(const char *cmd, int cmdLen, bool ok, int tries,
+		int timeouts, unsigned long rxBytes, s64 latencyUs) {
+	struct McuStats *st = NULL;
+	int i, prefixLen = min(cmdLen, 3);
+
+	spin_lock(&mcuStatsLock);
+	for (i = 0; i < MCU_STATS_SIZE; i++) {
+		if (mcuStats[i].prefix[0] == '\0') {
+			memcpy(mcuStats[i].prefix, cmd, prefixLen);
+			mcuStats[i].prefix[prefixLen] = '\0';
+		}
+		if (strncmp(mcuStats[i].prefix, cmd, prefixLen) == 0
+				&& mcuStats[i].prefix[prefixLen] == '\0') {
+			st = &mcuStats[i];
+			break;
+		}
 	}
+	if (st != NULL) {
+		st->count++;
+		if (!ok) {
+			st->errors++;
+		}
+		st->retries += tries - 1;
+		st->timeouts += timeouts;
+		st->txBytes += (unsigned long) cmdLen * tries;
+		st->rxBytes += rxBytes;
+		i = latencyUs > 1 ? ilog2((u64) latencyUs) : 0;
+		if (i >= MCU_LATENCY_HIST_SIZE) {
+			i = MCU_LATENCY_HIST_SIZE - 1;
+		}
+		st->latencyHist[i]++;
+	}
+	spin_unlock(&mcuStatsLock);
 }
 
 static bool softUartSendAndWait(const char *cmd, int cmdLen, int respLen,
 		int timeout, bool print) {
-	int i, waitTime;
+	int i;
+	int timeouts = 0;
+	unsigned long rxBytes = 0;
+	unsigned long idleUs;
+	s64 latencyUs;
+	ktime_t start = ktime_get();
+	unsigned long overflows = raspberry_soft_uart_get_rx_overflows();
+	trace_stratopi_mcu_cmd(cmd, cmdLen, respLen, timeout);
 	for (i = 0; i < 3; i++) {
-		waitTime = 0;
+		softUartRespLen = 0;
+		WRITE_ONCE(softUartRxError, false);
+		// discard late bytes of previous transactions
+		raspberry_soft_uart_flush_rx();
 		raspberry_soft_uart_open(NULL);
-		softUartRxBuffIdx = 0;
 		if (print) {
 			pr_info(LOG_TAG "soft uart >>> %s\n", cmd);
 		}
 		raspberry_soft_uart_send_string(cmd, cmdLen);
-		while (softUartRxBuffIdx < respLen && waitTime < timeout) {
-			msleep(20);
-			waitTime += 20;
-		}
+		softUartWaitResp(respLen, timeout);
 		raspberry_soft_uart_close();
-		softUartRxBuff[softUartRxBuffIdx] = '\0';
+		softUartReadResp();
 		if (print) {
-			pr_info(LOG_TAG "soft uart <<< %s\n", softUartRxBuff);
+			pr_info(LOG_TAG "soft uart <<< %s\n", softUartResp);
+		}
+		if (raspberry_soft_uart_get_rx_overflows() != overflows) {
+			pr_warn(LOG_TAG "soft uart RX overflow\n");
+			overflows = raspberry_soft_uart_get_rx_overflows();
 		}
-		if (softUartRxBuffIdx == respLen) {
+		rxBytes += softUartRespLen;
+		if (softUartRespLen == respLen) {
+			latencyUs = ktime_us_delta(ktime_get(), start);
+			trace_stratopi_mcu_cmd_done(cmd, cmdLen, true, i + 1, latencyUs);
+			mcuStatsRecord(cmd, cmdLen, true, i + 1, timeouts, rxBytes,
+					latencyUs);
 			return true;
 		}
+		trace_stratopi_mcu_cmd_retry(cmd, cmdLen, i + 1, softUartRespLen,
+				respLen);
+		if (READ_ONCE(softUartRxError)) {
+			// let the rest of the response go by, 10 bits per byte
+			idleUs = max(respLen - softUartRespLen, 0) * 10 * USEC_PER_SEC
+					/ SOFT_UART_BAUD;
+			usleep_range(idleUs + 1000, idleUs + 2000);
+			continue;
+		}
+		timeouts++;
 		msleep(50);
 	}
+	latencyUs = ktime_us_delta(ktime_get(), start);
+	trace_stratopi_mcu_cmd_done(cmd, cmdLen, false, i, latencyUs);
+	mcuStatsRecord(cmd, cmdLen, false, i, timeouts, rxBytes, latencyUs);
 	return false;
 }
 
-static ssize_t MCU_show(struct device *dev, struct device_attribute *attr,
-		char *buf) {
-	long val;
-	ssize_t ret;
-	char cmd[] = "XXX??";
-	int cmdLen = 4;
-	int prefixLen = 3;
-	int respLen = getMcuCmd(dev, attr, cmd);
-	if (respLen < 0) {
-		return -EINVAL;
+static int mcuCounters_show(struct seq_file *s, void *unused) {
+	int i;
+
+	seq_printf(s, "cmd  count    errors   retries  timeouts tx_bytes   "
+			"rx_bytes\n");
+	spin_lock(&mcuStatsLock);
+	for (i = 0; i < MCU_STATS_SIZE && mcuStats[i].prefix[0] != '\0'; i++) {
+		seq_printf(s, "%-4s %-8lu %-8lu %-8lu %-8lu %-10lu %lu\n",
+				mcuStats[i].prefix, mcuStats[i].count, mcuStats[i].errors,
+				mcuStats[i].retries, mcuStats[i].timeouts,
+				mcuStats[i].txBytes, mcuStats[i].rxBytes);
 	}
-	if (respLen == 5) {
-		cmdLen = 5;
-		prefixLen = 4;
+	spin_unlock(&mcuStatsLock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mcuCounters);
+
+static int mcuLatency_show(struct seq_file *s, void *unused) {
+	int i;
+
+	spin_lock(&mcuStatsLock);
+	for (i = 0; i < MCU_STATS_SIZE && mcuStats[i].prefix[0] != '\0'; i++) {
+		seq_printf(s, "%s:\n", mcuStats[i].prefix);
+		seqLog2Hist(s, mcuStats[i].latencyHist, MCU_LATENCY_HIST_SIZE);
 	}
+	spin_unlock(&mcuStatsLock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mcuLatency);
 
-	if (!mcuMutexLock()) {
-		return -EBUSY;
+/*
+ * Creates the MCU link debugfs entries: per command prefix counters and
+ * log2 histograms of the transactions latency, in microseconds.
+ */
+static void mcuDebugfsInit(struct dentry *parent) {
+	struct dentry *dir = debugfs_create_dir("mcu", parent);
+	debugfs_create_file("counters", 0444, dir, NULL, &mcuCounters_fops);
+	debugfs_create_file("latency_us", 0444, dir, NULL, &mcuLatency_fops);
+}
+
+static int mcuWorker(void *data) {
+	struct McuRequest *req;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(mcuQueueWq,
+				!list_empty(&mcuQueue) || kthread_should_stop());
+
+		spin_lock(&mcuQueueLock);
+		req = list_first_entry_or_null(&mcuQueue, struct McuRequest, list);
+		if (req != NULL) {
+			list_del_init(&req->list);
+		}
+		spin_unlock(&mcuQueueLock);
+
+		if (req != NULL) {
+			// the worker owns the soft UART, requests run back-to-back
+			req->result = req->run(req);
+			complete(&req->done);
+		}
 	}
 
-	if (!softUartSendAndWait(cmd, cmdLen, respLen, 300, false)) {
-		ret = -EIO;
-	} else if (kstrtol((const char*) (softUartRxBuff + prefixLen), 10, &val)
-			== 0) {
-		ret = sprintf(buf, "%ld\n", val);
-	} else {
-		ret = sprintf(buf, "%s\n", softUartRxBuff + prefixLen);
+	spin_lock(&mcuQueueLock);
+	while (!list_empty(&mcuQueue)) {
+		req = list_first_entry(&mcuQueue, struct McuRequest, list);
+		list_del_init(&req->list);
+		req->result = -ENODEV;
+		complete(&req->done);
 	}
+	spin_unlock(&mcuQueueLock);
 
-	mutex_unlock(&mcuMutex);
-	return ret;
+	return 0;
 }
 
-static ssize_t MCU_store(struct device *dev, struct device_attribute *attr,
-		const char *buf, size_t count) {
-	ssize_t ret = count;
-	size_t len = count;
-	int i;
-	int padd;
-	int prefixLen = 3;
-	char cmd[] = "XXX00000";
-	int cmdLen = getMcuCmd(dev, attr, cmd);
-	if (cmdLen < 0) {
-		return -EINVAL;
-	}
-	if (cmdLen == 5) {
-		prefixLen = 4;
+static bool mcuWorkerStart(void) {
+	struct task_struct *task;
+	task = kthread_run(mcuWorker, NULL, "stratopi_mcu");
+	if (IS_ERR(task)) {
+		return false;
 	}
-	while (len > 0
-			&& (buf[len - 1] == '\n' || buf[len - 1] == '\r'
-					|| buf[len - 1] == ' ')) {
-		len--;
+	spin_lock(&mcuQueueLock);
+	mcuWorkerTask = task;
+	spin_unlock(&mcuQueueLock);
+	return true;
+}
+
+static void mcuWorkerStop(void) {
+	struct task_struct *task;
+	spin_lock(&mcuQueueLock);
+	task = mcuWorkerTask;
+	mcuWorkerTask = NULL;
+	spin_unlock(&mcuQueueLock);
+	if (task != NULL) {
+		kthread_stop(task);
 	}
-	if (len < 1) {
-		return -EINVAL;
+}
+
+/*
+ * Queues a request to the MCU worker without waiting for it to run.
+ */
+static int mcuEnqueue(struct McuRequest *req) {
+	init_completion(&req->done);
+	INIT_LIST_HEAD(&req->list);
+
+	spin_lock(&mcuQueueLock);
+	if (mcuWorkerTask == NULL) {
+		spin_unlock(&mcuQueueLock);
+		return -ENODEV;
+	}
+	list_add_tail(&req->list, &mcuQueue);
+	spin_unlock(&mcuQueueLock);
+	wake_up(&mcuQueueWq);
+	return 0;
+}
+
+/*
+ * Queues a request to the MCU worker and waits for its completion.
+ * Returns -EBUSY if the request could not be started within
+ * MCU_QUEUE_TIMEOUT_MS.
+ */
+static int mcuSubmit(struct McuRequest *req) {
+	int ret = mcuEnqueue(req);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (!wait_for_completion_timeout(&req->done,
+			msecs_to_jiffies(MCU_QUEUE_TIMEOUT_MS))) {
+		spin_lock(&mcuQueueLock);
+		if (!list_empty(&req->list)) {
+			// still queued, withdraw it
+			list_del_init(&req->list);
+			spin_unlock(&mcuQueueLock);
+			return -EBUSY;
+		}
+		spin_unlock(&mcuQueueLock);
+		// running, wait for it to end without triggering hung task warnings
+		while (!wait_for_completion_timeout(&req->done, HZ)) {
+		}
 	}
-	padd = cmdLen - prefixLen - len;
-	if (padd < 0 || padd > 4) {
-		return -EINVAL;
+	return req->result;
+}
+
+static int mcuRunCmd(struct McuRequest *req) {
+	if (!softUartSendAndWait(req->cmd, req->cmdLen, req->respLen,
+			req->timeout, false)) {
+		return -EIO;
 	}
-	for (i = 0; i < len; i++) {
-		cmd[prefixLen + padd + i] = toUpper(buf[i]);
+	memcpy(req->resp, softUartResp, softUartRespLen + 1);
+	return 0;
+}
+
+static struct McuCacheEntry* mcuCacheFind(const char *cmd, int prefixLen) {
+	int i;
+	for (i = 0; i < MCU_CACHE_SIZE; i++) {
+		if (mcuCache[i].prefix[0] != '\0'
+				&& strlen(mcuCache[i].prefix) == prefixLen
+				&& strncmp(mcuCache[i].prefix, cmd, prefixLen) == 0) {
+			return &mcuCache[i];
+		}
 	}
-	cmd[prefixLen + padd + i] = '\0';
+	return NULL;
+}
 
-	if (!mcuMutexLock()) {
-		return -EBUSY;
+static bool mcuCacheGet(const char *cmd, int prefixLen, char *val) {
+	struct McuCacheEntry *e;
+	unsigned int ttl = READ_ONCE(mcuCacheTtlMs);
+	bool hit = false;
+
+	if (ttl == 0) {
+		return false;
 	}
+	spin_lock(&mcuCacheLock);
+	e = mcuCacheFind(cmd, prefixLen);
+	if (e != NULL && e->valid
+			&& time_before(jiffies, e->stamp + msecs_to_jiffies(ttl))) {
+		strscpy(val, e->val, MCU_CACHE_VAL_LEN);
+		hit = true;
+	}
+	spin_unlock(&mcuCacheLock);
+	return hit;
+}
 
-	if (!softUartSendAndWait(cmd, cmdLen, cmdLen, 300, false)) {
-		ret = -EIO;
-	} else {
-		for (i = 0; i < padd; i++) {
-			if (softUartRxBuff[prefixLen + i] != '0') {
-				ret = -EIO;
-				break;
-			}
-		}
-		if (ret == count) {
-			for (i = 0; i < len; i++) {
-				if (softUartRxBuff[prefixLen + padd + i] != toUpper(buf[i])) {
-					ret = -EIO;
-					break;
-				}
-			}
+static void mcuCachePut(const char *cmd, int prefixLen, const char *val) {
+	int i;
+	struct McuCacheEntry *e;
+
+	spin_lock(&mcuCacheLock);
+	e = mcuCacheFind(cmd, prefixLen);
+	for (i = 0; e == NULL && i < MCU_CACHE_SIZE; i++) {
+		if (mcuCache[i].prefix[0] == '\0') {
+			e = &mcuCache[i];
+			memcpy(e->prefix, cmd, prefixLen);
+			e->prefix[prefixLen] = '\0';
 		}
 	}
-	mutex_unlock(&mcuMutex);
-	return ret;
+	if (e != NULL) {
+		strscpy(e->val, val, MCU_CACHE_VAL_LEN);
+		e->stamp = jiffies;
+		e->valid = true;
+	}
+	spin_unlock(&mcuCacheLock);
 }
 
-static int hex2int(char ch) {
-	if (ch >= '0' && ch <= '9')
-		return ch - '0';
-	if (ch >= 'A' && ch <= 'F')
-		return ch - 'A' + 10;
-	if (ch >= 'a' && ch <= 'f')
-		return ch - 'a' + 10;
-	return -1;
+/*
+ * Invalidates the cached values whose command starts with the given group
+ * prefix, e.g. "XW" for all the watchdog parameters, or all the values if
+ * the group is "X".
+ */
+static void mcuCacheInvalidate(const char *group) {
+	int i;
+	spin_lock(&mcuCacheLock);
+	for (i = 0; i < MCU_CACHE_SIZE; i++) {
+		if (startsWith(mcuCache[i].prefix, group)) {
+			mcuCache[i].valid = false;
+		}
+	}
+	spin_unlock(&mcuCacheLock);
 }
 
-static int nextByte(const char *buf, int offset) {
-	int h, l;
-	if (offset >= strlen(buf) - 1) {
-		pr_err(LOG_TAG "invalid hex file - reached end of line\n");
-		return -1;
-	}
-	h = hex2int(buf[offset]);
-	l = hex2int(buf[offset + 1]);
-	if (h < 0 || l < 0) {
-		pr_err(LOG_TAG "invalid hex file - illegal character\n");
-		return -1;
+/*
+ * Reads ("<prefix>?") or writes an MCU parameter, updating the cache from
+ * the worker, so that cache updates happen in the same order as the
+ * transactions on the wire and a read cannot publish a value older than
+ * a later write.
+ */
+static int mcuRunAttrCmd(struct McuRequest *req) {
+	int ret;
+	int prefixLen = req->cachePrefixLen;
+	bool read = req->cmd[prefixLen] == '?';
+	char group[] = "XX";
+
+	if (!read) {
+		// a parameter may affect others of its group, e.g. XWED sets XWSD1
+		group[1] = req->cmd[1];
+		mcuCacheInvalidate(group);
+	}
+
+	ret = mcuRunCmd(req);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (read) {
+		mcuCachePut(req->cmd, prefixLen, req->resp + prefixLen);
+	} else if (strncmp(req->resp + prefixLen, req->cmd + prefixLen,
+			req->cmdLen - prefixLen) == 0) {
+		if (startsWith(req->cmd, "XCCR")) {
+			// factory configuration restored
+			mcuCacheInvalidate("X");
+		} else if (!startsWith(req->cmd, "XCC")) {
+			mcuCachePut(req->cmd, prefixLen, req->cmd + prefixLen);
+		}
 	}
-	return (h << 4) | l;
+	return 0;
 }
 
-static void fwCmdChecksum(char *cmd, int len) {
-	int i, checksum = 0;
-	for (i = 0; i < len - 2; i++) {
-		checksum += (cmd[i] & 0xff);
+static int mcuAttrSendAndWait(struct McuRequest *req, const char *cmd,
+		int cmdLen, int respLen, int prefixLen) {
+	if (READ_ONCE(fwInstalling)) {
+		return -EBUSY;
 	}
-	checksum = ~checksum;
-	cmd[len - 2] = (checksum >> 8) & 0xff;
-	cmd[len - 1] = checksum & 0xff;
+	req->run = mcuRunAttrCmd;
+	req->cmd = cmd;
+	req->cmdLen = cmdLen;
+	req->respLen = respLen;
+	req->timeout = 300;
+	req->cachePrefixLen = prefixLen;
+	return mcuSubmit(req);
 }
 
-static bool fwSendCmd(int addr, char *cmd, int cmdLen, int respLen,
-		const char *respPrefix) {
-	cmd[3] = (addr >> 8) & 0xff;
-	cmd[4] = addr & 0xff;
-	fwCmdChecksum(cmd, 72);
-	if (!softUartSendAndWait(cmd, cmdLen, respLen, 1000, false)) {
-		pr_err(LOG_TAG "FW cmd error 1\n");
-		return false;
+static ssize_t mcuFormatVal(char *buf, const char *val) {
+	long l;
+	if (kstrtol(val, 10, &l) == 0) {
+		return sprintf(buf, "%ld\n", l);
 	}
-	if (!startsWith((const char*) softUartRxBuff, respPrefix)) {
-		pr_err(LOG_TAG "FW cmd error 2\n");
-		return false;
+	return sprintf(buf, "%s\n", val);
+}
+
+/*
+ * Reads all the configuration parameters back-to-back within a single
+ * worker request, so that no other command can be interleaved.
+ */
+static int mcuConfigReadAll(struct McuRequest *req) {
+	struct McuConfigBatch *batch = container_of(req, struct McuConfigBatch,
+			req);
+	struct McuConfigAttr *ca;
+	char cmd[8];
+	int i, prefixLen;
+
+	for (i = 0; i < mcuConfigAttrsNum; i++) {
+		ca = &mcuConfigAttrs[i];
+		prefixLen = strlen(ca->ma->cmd);
+		sprintf(cmd, "%s?", ca->ma->cmd);
+		if (!softUartSendAndWait(cmd, prefixLen + 1, ca->ma->respLen,
+				req->timeout, false)) {
+			pr_warn(LOG_TAG "config read failed: %s/%s\n", ca->db->name,
+					ca->ma->attr.devAttr.attr.name);
+			return -EIO;
+		}
+		strscpy(batch->vals[i], softUartResp + prefixLen, MCU_CACHE_VAL_LEN);
+		mcuCachePut(ca->ma->cmd, prefixLen, batch->vals[i]);
 	}
-	return true;
+	return 0;
 }
 
-static ssize_t fwInstall_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t bufLen) {
-	uint8_t data[FW_MAX_DATA_BYTES_PER_LINE];
-	int i, buff_i, count, addrH, addrL, addr, type, checksum, baseAddr = 0;
-	bool eof = false;
-	char *eol;
-	char cmd[72 + 1];
+static ssize_t configAll_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	struct McuConfigBatch batch;
+	struct McuConfigAttr *ca;
+	ssize_t ret = 0;
+	int i;
 
-	if (!mcuMutexLock()) {
+	if (READ_ONCE(fwInstalling)) {
 		return -EBUSY;
 	}
+	batch.req.run = mcuConfigReadAll;
+	batch.req.timeout = 300;
+	i = mcuSubmit(&batch.req);
+	if (i < 0) {
+		return i;
+	}
 
-	fwProgress = 0;
+	for (i = 0; i < mcuConfigAttrsNum; i++) {
+		ca = &mcuConfigAttrs[i];
+		ret += sprintf(buf + ret, "%s/%s=", ca->db->name,
+				ca->ma->attr.devAttr.attr.name);
+		ret += mcuFormatVal(buf + ret, batch.vals[i]);
+	}
+	return ret;
+}
 
-	if (startsWith(buf, ":020000040000FA")) {
-		pr_info(LOG_TAG "loading firmware file...\n");
-		fwLineIdx = 0;
-		fwMaxAddr = 0;
-		for (i = 0; i < FW_MAX_SIZE; i++) {
-			fwBytes[i] = 0xff;
-		}
+static bool mcuConfigSend(const char *prefix, const char *val, int timeout) {
+	char cmd[MCU_CACHE_VAL_LEN + 8];
+	int prefixLen = strlen(prefix);
+	int cmdLen = sprintf(cmd, "%s%s", prefix, val);
+
+	if (!softUartSendAndWait(cmd, cmdLen, cmdLen, timeout, false)) {
+		return false;
 	}
+	return strncmp(softUartResp + prefixLen, val, cmdLen - prefixLen) == 0;
+}
 
-	buff_i = 0;
-	while (buff_i < bufLen) {
-		if (fwLineIdx == 0 && buf[buff_i++] != ':') {
-			continue;
+/*
+ * Writes all the entries of mcuConfigApply within a single worker request.
+ * The previous values are read first, so that on the first failure the
+ * entries already written can be restored.
+ */
+static int mcuConfigWriteAll(struct McuRequest *req) {
+	struct McuConfigApply *ap = container_of(req, struct McuConfigApply, req);
+	struct McuConfigApplyEntry *e;
+	struct McuAttrBean *ma;
+	char cmd[8];
+	int i, j, prefixLen;
+
+	// parameters may affect others, refreshed from the MCU on next read
+	mcuCacheInvalidate("X");
+
+	for (i = 0; i < ap->num; i++) {
+		e = &ap->entries[i];
+		ma = mcuConfigAttrs[e->attrIdx].ma;
+		prefixLen = strlen(ma->cmd);
+
+		sprintf(cmd, "%s?", ma->cmd);
+		if (!softUartSendAndWait(cmd, prefixLen + 1, ma->respLen,
+				req->timeout, false)) {
+			e->status = "read failed";
+			break;
 		}
+		strscpy(e->old, softUartResp + prefixLen, MCU_CACHE_VAL_LEN);
 
-		eol = strchr(buf + buff_i, '\n');
-		if (eol == NULL) {
-			eol = strchr(buf + buff_i, '\r');
-			if (eol == NULL) {
-				strcpy(fwLine, buf + buff_i);
-				fwLineIdx = bufLen - buff_i;
-				pr_info(LOG_TAG "waiting for data...\n");
-				mutex_unlock(&mcuMutex);
-				return bufLen;
-			}
+		if (!mcuConfigSend(ma->cmd, e->val, req->timeout)) {
+			e->status = "write failed";
+			break;
 		}
+		e->status = ma->persistent || ap->save ? "ok" : "ok, not saved";
+	}
 
-		i = (int) (eol - (buf + buff_i));
-		strncpy(fwLine + fwLineIdx, buf + buff_i, i);
-		fwLine[i + fwLineIdx] = '\0';
-		fwLineIdx = 0;
-
-		// pr_info(LOG_TAG "line - %s\n", fwLine);
-
-		count = nextByte(fwLine, 0);
-		addrH = nextByte(fwLine, 2);
-		addrL = nextByte(fwLine, 4);
-		type = nextByte(fwLine, 6);
-		if (count < 0 || addrH < 0 || addrL < 0 || type < 0) {
-			mutex_unlock(&mcuMutex);
-			return -EINVAL;
+	if (i < ap->num) {
+		for (j = i + 1; j < ap->num; j++) {
+			ap->entries[j].status = "not applied";
 		}
-		checksum = count + addrH + addrL + type;
-		for (i = 0; i < count; i++) {
-			data[i] = nextByte(fwLine, 8 + (i * 2));
-			if (data[i] < 0) {
-				mutex_unlock(&mcuMutex);
-				return -EINVAL;
+		// a failed write may have been applied anyway, e.g. if the reply
+		// was lost, so it is restored too
+		if (strcmp(ap->entries[i].status, "write failed") == 0) {
+			e = &ap->entries[i];
+			ma = mcuConfigAttrs[e->attrIdx].ma;
+			if (mcuConfigSend(ma->cmd, e->old, req->timeout)) {
+				e->status = "write failed, rolled back";
+			} else {
+				e->status = "write failed, rollback failed";
 			}
-			checksum += data[i];
 		}
-		checksum += nextByte(fwLine, 8 + (i * 2));
-		if ((checksum & 0xff) != 0) {
-			pr_err(LOG_TAG "invalid hex file - checksum error\n");
-			mutex_unlock(&mcuMutex);
-			return -EINVAL;
+		for (j = i - 1; j >= 0; j--) {
+			e = &ap->entries[j];
+			ma = mcuConfigAttrs[e->attrIdx].ma;
+			if (mcuConfigSend(ma->cmd, e->old, req->timeout)) {
+				e->status = "rolled back";
+			} else {
+				e->status = "rollback failed";
+			}
+		}
+		if (ap->save) {
+			ap->saveStatus = "not applied";
 		}
+		return -EIO;
+	}
 
-		if (type == 0) {
-			addr = ((addrH << 8) | addrL) + baseAddr;
-			// pr_info(LOG_TAG "addr %d\n", addr);
-			if (addr + count < FW_MAX_SIZE) {
-				for (i = 0; i < count; i++) {
-					fwBytes[addr + i] = data[i];
-				}
-				i = addr + i - 1;
-				if (i > fwMaxAddr) {
-					fwMaxAddr = i;
-				}
-			}
-		} else if (type == 1) {
-			eof = true;
-			break;
-		} else if (type == 2) {
-			baseAddr = ((data[0] << 8) | data[1]) * 16;
-		} else if (type == 4) {
-			baseAddr = ((data[0] << 8) | data[1]) << 16;
+	for (i = 0; i < ap->num; i++) {
+		e = &ap->entries[i];
+		ma = mcuConfigAttrs[e->attrIdx].ma;
+		mcuCachePut(ma->cmd, strlen(ma->cmd), e->val);
+	}
+
+	if (ap->save) {
+		if (softUartSendAndWait("XCCS", 4, 4, req->timeout, false)
+				&& strncmp(softUartResp, "XCCS", 4) == 0) {
+			ap->saveStatus = "ok";
 		} else {
-			pr_info(LOG_TAG "ignored record type %d\n", type);
+			ap->saveStatus = "failed";
+			return -EIO;
 		}
 	}
+	return 0;
+}
 
-	if (!eof) {
-		pr_info(LOG_TAG "waiting for data...\n");
-		mutex_unlock(&mcuMutex);
-		return bufLen;
+static int mcuConfigApplyParse(struct McuConfigApply *ap, char *doc) {
+	struct McuConfigApplyEntry *e;
+	struct McuConfigAttr *ca;
+	char *line, *key, *val, *attrName;
+	int i, j;
+
+	ap->num = 0;
+	ap->save = false;
+	ap->saveStatus = NULL;
+
+	while ((line = strsep(&doc, "\n")) != NULL) {
+		line = strim(line);
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+		val = strchr(line, '=');
+		if (val == NULL) {
+			return -EINVAL;
+		}
+		*val++ = '\0';
+		key = strim(line);
+		val = strim(val);
+
+		if (strcmp(key, "mcu/config") == 0) {
+			if (strcmp(val, "S") != 0 && strcmp(val, "s") != 0) {
+				return -EINVAL;
+			}
+			ap->save = true;
+			continue;
+		}
+
+		attrName = strchr(key, '/');
+		if (attrName == NULL) {
+			return -EINVAL;
+		}
+		*attrName++ = '\0';
+		for (i = 0; i < mcuConfigAttrsNum; i++) {
+			ca = &mcuConfigAttrs[i];
+			if (strcmp(ca->db->name, key) == 0
+					&& strcmp(ca->ma->attr.devAttr.attr.name, attrName) == 0) {
+				break;
+			}
+		}
+		if (i == mcuConfigAttrsNum) {
+			return -EINVAL;
+		}
+		for (j = 0; j < ap->num; j++) {
+			if (ap->entries[j].attrIdx == i) {
+				return -EINVAL;
+			}
+		}
+
+		e = &ap->entries[ap->num++];
+		e->attrIdx = i;
+		e->status = "not applied";
+		if (mcuAttrFormatVal(ca->ma, val, strlen(val), e->val) < 0) {
+			return -EINVAL;
+		}
 	}
+	return 0;
+}
 
-	if (fwMaxAddr < 0x05be) {
-		pr_err(LOG_TAG "invalid hex file - no model\n");
-		mutex_unlock(&mcuMutex);
-		return -EINVAL;
+static ssize_t configApply_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	struct McuConfigApply *ap = &mcuConfigApply;
+	struct McuConfigAttr *ca;
+	ssize_t ret = 0;
+	int i;
+
+	mutex_lock(&mcuConfigApplyMutex);
+	for (i = 0; i < ap->num; i++) {
+		ca = &mcuConfigAttrs[ap->entries[i].attrIdx];
+		ret += sprintf(buf + ret, "%s/%s=%s\n", ca->db->name,
+				ca->ma->attr.devAttr.attr.name, ap->entries[i].status);
 	}
+	if (ap->saveStatus != NULL) {
+		ret += sprintf(buf + ret, "mcu/config=%s\n", ap->saveStatus);
+	}
+	mutex_unlock(&mcuConfigApplyMutex);
+	return ret;
+}
 
-	if (model_num != fwBytes[0x05be]) {
-		pr_err(LOG_TAG "invalid hex file - missmatching model %d != %d\n",
-				model_num, fwBytes[0x05be]);
-		mutex_unlock(&mcuMutex);
-		return -EINVAL;
+static ssize_t configApply_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	struct McuConfigApply *ap = &mcuConfigApply;
+	char *doc;
+	int ret;
+
+	if (READ_ONCE(fwInstalling)) {
+		return -EBUSY;
+	}
+	doc = kstrndup(buf, count, GFP_KERNEL);
+	if (doc == NULL) {
+		return -ENOMEM;
+	}
+	// writers queue behind the one in progress, like the other MCU requests
+	if (mutex_lock_interruptible(&mcuConfigApplyMutex)) {
+		kfree(doc);
+		return -ERESTARTSYS;
+	}
+
+	ret = mcuConfigApplyParse(ap, doc);
+	kfree(doc);
+	if (ret < 0) {
+		ap->num = 0;
+		ap->saveStatus = NULL;
+		goto out;
+	}
+
+	ap->req.run = mcuConfigWriteAll;
+	ap->req.timeout = 300;
+	ret = mcuSubmit(&ap->req);
+
+	out:
+	mutex_unlock(&mcuConfigApplyMutex);
+	return ret < 0 ? ret : count;
+}
+
+/*
+ * Reads the value of the MCU parameter of ma, from the cache if still
+ * valid, into val (MCU_CACHE_VAL_LEN). Returns 0 or a negative error.
+ */
+static int mcuAttrRead(struct McuAttrBean *ma, char *val) {
+	int ret;
+	struct McuRequest req;
+	char cmd[8];
+	int prefixLen = strlen(ma->cmd);
+
+	if (!mcuCacheGet(ma->cmd, prefixLen, val)) {
+		sprintf(cmd, "%s?", ma->cmd);
+		ret = mcuAttrSendAndWait(&req, cmd, prefixLen + 1, mcuAttrRespLen(ma),
+				prefixLen);
+		if (ret < 0) {
+			return ret;
+		}
+		strscpy(val, req.resp + prefixLen, MCU_CACHE_VAL_LEN);
+	}
+	return 0;
+}
+
+static ssize_t MCU_show(struct device *dev, struct device_attribute *attr,
+		char *buf) {
+	int ret;
+	char val[MCU_CACHE_VAL_LEN];
+
+	ret = mcuAttrRead(mcuAttrGet(attr), val);
+	if (ret < 0) {
+		return ret;
+	}
+	return mcuFormatVal(buf, val);
+}
+
+/*
+ * Writes a value of len characters to the MCU parameter of ma.
+ * Returns 0 or a negative error.
+ */
+static int mcuAttrWrite(struct McuAttrBean *ma, const char *buf, size_t len) {
+	int ret;
+	struct McuRequest req;
+	char val[MCU_CACHE_VAL_LEN];
+	char cmd[MCU_CACHE_VAL_LEN + 8];
+	int prefixLen = strlen(ma->cmd);
+	int valLen;
+
+	valLen = mcuAttrFormatVal(ma, buf, len, val);
+	if (valLen < 0) {
+		return valLen;
+	}
+	sprintf(cmd, "%s%s", ma->cmd, val);
+
+	// the cache is updated by the worker
+	ret = mcuAttrSendAndWait(&req, cmd, ma->respLen, ma->respLen, prefixLen);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (strncmp(req.resp + prefixLen, val, valLen) != 0) {
+		return -EIO;
+	}
+	return 0;
+}
+
+static ssize_t MCU_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count) {
+	int ret;
+	size_t len = count;
+
+	while (len > 0
+			&& (buf[len - 1] == '\n' || buf[len - 1] == '\r'
+					|| buf[len - 1] == ' ')) {
+		len--;
+	}
+	ret = mcuAttrWrite(mcuAttrGet(attr), buf, len);
+	if (ret < 0) {
+		return ret;
 	}
+	return count;
+}
+
+static int hex2int(char ch) {
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	return -1;
+}
+
+static int fwStageStart(void) {
+	if (fwBytes == NULL) {
+		// room for the last block, padded up to the block size
+		fwBytes = vmalloc(FW_MAX_SIZE + FW_BLOCK_SIZE);
+		if (fwBytes == NULL) {
+			return -ENOMEM;
+		}
+	}
+	memset(fwBytes, 0xff, FW_MAX_SIZE + FW_BLOCK_SIZE);
+	memset(&fwHex, 0, sizeof(fwHex));
+	fwMaxAddr = 0;
+	fwProgress = 0;
+	return 0;
+}
+
+static void fwStageFree(void) {
+	vfree(fwBytes);
+	fwBytes = NULL;
+	memset(&fwHex, 0, sizeof(fwHex));
+}
+
+static void fwSetState(enum FwState state) {
+	WRITE_ONCE(fwState, state);
+	if (!IS_ERR_OR_NULL(devMcu.device)) {
+		sysfs_notify(&devMcu.device->kobj, NULL, "fw_install_state");
+	}
+}
+
+static void fwCmdChecksum(char *cmd, int len) {
+	int i, checksum = 0;
+	for (i = 0; i < len - 2; i++) {
+		checksum += (cmd[i] & 0xff);
+	}
+	checksum = ~checksum;
+	cmd[len - 2] = (checksum >> 8) & 0xff;
+	cmd[len - 1] = checksum & 0xff;
+}
+
+static bool fwSendCmd(int addr, char *cmd, int cmdLen, int respLen,
+		const char *respPrefix) {
+	cmd[3] = (addr >> 8) & 0xff;
+	cmd[4] = addr & 0xff;
+	fwCmdChecksum(cmd, 72);
+	if (!softUartSendAndWait(cmd, cmdLen, respLen, 1000, false)) {
+		pr_err(LOG_TAG "FW cmd error 1\n");
+		return false;
+	}
+	if (!startsWith(softUartResp, respPrefix)) {
+		pr_err(LOG_TAG "FW cmd error 2\n");
+		return false;
+	}
+	return true;
+}
+
+static void fwBlockCmd(char *cmd, char op, const uint8_t *data) {
+	cmd[0] = 'X';
+	cmd[1] = 'B';
+	cmd[2] = op;
+	cmd[5] = FW_BLOCK_SIZE;
+	memcpy(cmd + 6, data, FW_BLOCK_SIZE);
+	cmd[72] = '\0';
+}
+
+static bool fwCheckBlock(int addr, const uint8_t *data) {
+	bool match;
+	char cmd[72 + 1];
+
+	fwBlockCmd(cmd, 'R', data);
+	if (!fwSendCmd(addr, cmd, 6, 72, "XBR")) {
+		return false;
+	}
+	match = memcmp(cmd, softUartResp, 72) == 0;
+	trace_stratopi_fw_block_verified(addr, match);
+	return match;
+}
+
+/*
+ * Writes a block and, if verify is set, reads it back right away, so
+ * that a failed block is retried on its own instead of restarting the
+ * whole upload. If diff is set the block is read first and not written
+ * if already matching.
+ */
+static bool fwWriteBlock(int addr, const uint8_t *data, bool diff,
+		bool verify) {
+	int i;
+	char cmd[72 + 1];
+
+	if (diff && fwCheckBlock(addr, data)) {
+		fwStats.skipped++;
+		return true;
+	}
+
+	for (i = 0; i < FW_BLOCK_TRIES; i++) {
+		if (i > 0) {
+			fwStats.retried++;
+		}
+		fwBlockCmd(cmd, 'W', data);
+		if (!fwSendCmd(addr, cmd, 72, 5, "XBWOK")) {
+			continue;
+		}
+		if (!verify || fwCheckBlock(addr, data)) {
+			fwStats.written++;
+			trace_stratopi_fw_block_written(addr, i + 1, true);
+			return true;
+		}
+		pr_warn(LOG_TAG "FW check error at 0x%04x\n", addr);
+	}
+	trace_stratopi_fw_block_written(addr, i, false);
+	pr_err(LOG_TAG "FW block 0x%04x write failed\n", addr);
+	return false;
+}
+
+static int fwInstallRun(struct McuRequest *req) {
+	int addr;
+	int ret = -EIO;
+	uint8_t blank[FW_BLOCK_SIZE];
+
+	WRITE_ONCE(fwInstalling, true);
+	fwSetState(FW_STATE_FLASHING);
+	mcuCacheInvalidate("X");
+	memset(&fwStats, 0, sizeof(fwStats));
 
 	pr_info(LOG_TAG "enabling boot loader...\n");
 	if (!softUartSendAndWait("XBOOT", 5, 7, 300, true)) {
 		pr_err(LOG_TAG "boot loader enable error 1\n");
-		mutex_unlock(&mcuMutex);
-		return -EIO;
+		goto out;
 	}
-	if (strcmp("XBOOTOK", (const char*) softUartRxBuff) != 0
-			&& strcmp("XBOOTIN", (const char*) softUartRxBuff) != 0) {
+	if (strcmp("XBOOTOK", softUartResp) != 0
+			&& strcmp("XBOOTIN", softUartResp) != 0) {
 		pr_err(LOG_TAG "boot loader enable error 2\n");
-		mutex_unlock(&mcuMutex);
-		return -EIO;
+		goto out;
 	}
 	pr_info(LOG_TAG "boot loader enabled\n");
 
 	gpioSetVal(&gpioShutdown, 1);
 
-	cmd[0] = 'X';
-	cmd[1] = 'B';
-	cmd[2] = 'W';
-	cmd[5] = 64;
-	cmd[72] = '\0';
-
-	fwMaxAddr += 64;
+	fwMaxAddr += FW_BLOCK_SIZE;
 
 	pr_info(LOG_TAG "invalidating FW...\n");
-	for (i = 0; i < 64; i++) {
-		cmd[6 + i] = 0xff;
-	}
-	if (!fwSendCmd(0x05C0, cmd, 72, 5, "XBWOK")) {
-		mutex_unlock(&mcuMutex);
-		return -EIO;
+	memset(blank, 0xff, FW_BLOCK_SIZE);
+	// the validity block is only written, as before, never read back
+	if (!fwWriteBlock(0x05C0, blank, false, false)) {
+		goto out;
 	}
 
 	pr_info(LOG_TAG "writing FW...\n");
-	for (i = 0; i <= fwMaxAddr - 0x0600; i++) {
-		addr = 0x0600 + i;
-		cmd[6 + (i % 64)] = fwBytes[addr];
-		if (i % 64 == 63) {
-			// pr_info(LOG_TAG "writing addr %d\n", addr - 63);
-			if (!fwSendCmd(addr - 63, cmd, 72, 5, "XBWOK")) {
-				mutex_unlock(&mcuMutex);
-				return -EIO;
-			}
-			fwProgress = i * 50 / (fwMaxAddr - 0x0600);
-			pr_info(LOG_TAG "progress %d%%\n", fwProgress);
+	for (addr = 0x0600; addr + FW_BLOCK_SIZE - 1 <= fwMaxAddr;
+			addr += FW_BLOCK_SIZE) {
+		if (!fwWriteBlock(addr, fwBytes + addr, fw_install_diff, true)) {
+			goto out;
 		}
+		fwProgress = (addr + FW_BLOCK_SIZE - 1 - 0x0600) * 99
+				/ (fwMaxAddr - 0x0600);
+		pr_info(LOG_TAG "progress %d%%\n", fwProgress);
+	}
+
+	fwSetState(FW_STATE_VALIDATING);
+
+	pr_info(LOG_TAG "validating FW...\n");
+	if (!fwWriteBlock(0x05C0, fwBytes + 0x05C0, false, false)) {
+		goto out;
 	}
 
-	pr_info(LOG_TAG "checking FW...\n");
-	cmd[2] = 'R';
-	for (i = 0; i <= fwMaxAddr - 0x0600; i++) {
-		addr = 0x0600 + i;
-		cmd[6 + (i % 64)] = fwBytes[addr];
-		if (i % 64 == 63) {
-			// pr_info(LOG_TAG "reading addr %d\n", addr - 63);
-			if (!fwSendCmd(addr - 63, cmd, 6, 72, "XBR")) {
-				mutex_unlock(&mcuMutex);
-				return -EIO;
+	fwProgress = 100;
+	pr_info(LOG_TAG "progress %d%%\n", fwProgress);
+
+	pr_info(LOG_TAG "firmware installed. Waiting for shutdown...\n");
+	ret = 0;
+
+	out:
+	pr_info(LOG_TAG "FW blocks written=%d skipped=%d retried=%d\n",
+			fwStats.written, fwStats.skipped, fwStats.retried);
+	mutex_lock(&fwMutex);
+	fwStageFree();
+	mutex_unlock(&fwMutex);
+	WRITE_ONCE(fwInstalling, false);
+	fwSetState(ret == 0 ? FW_STATE_DONE : FW_STATE_ERROR);
+	return ret;
+}
+
+/*
+ * Processes the complete record in fwHex.rec.
+ * Returns 1 on end-of-file record, 0 on success, -EINVAL on error.
+ */
+static int fwHexRecord(void) {
+	int i, checksum = 0;
+	u32 addr;
+	int count = fwHex.rec[0];
+	int type = fwHex.rec[3];
+	uint8_t *data = fwHex.rec + 4;
+
+	for (i = 0; i < fwHex.len; i++) {
+		checksum += fwHex.rec[i];
+	}
+	if ((checksum & 0xff) != 0) {
+		pr_err(LOG_TAG "invalid hex file - checksum error\n");
+		return -EINVAL;
+	}
+
+	if (type == 0) {
+		addr = ((fwHex.rec[1] << 8) | fwHex.rec[2]) + fwHex.baseAddr;
+		if (addr >= FW_MAX_SIZE) {
+			// e.g. config or EEPROM data, not part of the flash image
+			pr_info(LOG_TAG "ignored record at 0x%x\n", addr);
+			return 0;
+		}
+		if (count > FW_MAX_SIZE - addr) {
+			pr_err(LOG_TAG "invalid hex file - address out of range\n");
+			return -EINVAL;
+		}
+		memcpy(fwBytes + addr, data, count);
+		if ((int) (addr + count) - 1 > fwMaxAddr) {
+			fwMaxAddr = addr + count - 1;
+		}
+	} else if (type == 1) {
+		return 1;
+	} else if (type == 2 || type == 4) {
+		if (count != 2) {
+			pr_err(LOG_TAG "invalid hex file - bad address record\n");
+			return -EINVAL;
+		}
+		if (type == 2) {
+			fwHex.baseAddr = (u32) ((data[0] << 8) | data[1]) * 16;
+		} else {
+			fwHex.baseAddr = (u32) ((data[0] << 8) | data[1]) << 16;
+		}
+	} else {
+		pr_info(LOG_TAG "ignored record type %d\n", type);
+	}
+	return 0;
+}
+
+/*
+ * Feeds len characters of a HEX file to the parser, records can span
+ * multiple calls. Returns 1 once the end-of-file record has been
+ * processed, 0 if more data is needed, -EINVAL on error.
+ */
+static int fwHexParse(const char *buf, size_t len) {
+	int i, val, ret;
+
+	for (i = 0; i < len; i++) {
+		if (!fwHex.inRecord) {
+			// anything between records is ignored
+			if (buf[i] == ':') {
+				fwHex.inRecord = true;
+				fwHex.lowNibble = false;
+				fwHex.len = 0;
 			}
-			if (memcmp(cmd, (const char*) softUartRxBuff, 72) != 0) {
-				pr_err(LOG_TAG "FW check error\n");
-				mutex_unlock(&mcuMutex);
-				return -EIO;
+			continue;
+		}
+
+		val = hex2int(buf[i]);
+		if (val < 0) {
+			pr_err(LOG_TAG "invalid hex file - truncated record\n");
+			return -EINVAL;
+		}
+		if (fwHex.lowNibble) {
+			fwHex.rec[fwHex.len++] |= val;
+		} else {
+			fwHex.rec[fwHex.len] = val << 4;
+		}
+		fwHex.lowNibble = !fwHex.lowNibble;
+
+		if (fwHex.len > 0 && fwHex.len == fwHex.rec[0] + 5) {
+			fwHex.inRecord = false;
+			ret = fwHexRecord();
+			if (ret != 0) {
+				return ret;
 			}
-			fwProgress = 50 + i * 49 / (fwMaxAddr - 0x0600);
-			pr_info(LOG_TAG "progress %d%%\n", fwProgress);
 		}
 	}
+	return 0;
+}
 
-	pr_info(LOG_TAG "validating FW...\n");
-	cmd[2] = 'W';
-	for (i = 0; i < 64; i++) {
-		cmd[6 + i] = fwBytes[0x05C0 + i];
+/*
+ * Checks the staged image and queues its installation.
+ * The staging buffer is freed on error.
+ */
+static int fwStageCommit(void) {
+	int ret;
+
+	if (fwMaxAddr < 0x05be) {
+		pr_err(LOG_TAG "invalid firmware - no model\n");
+		fwStageFree();
+		return -EINVAL;
+	}
+
+	if (model_num != fwBytes[0x05be]) {
+		pr_err(LOG_TAG "invalid firmware - missmatching model %d != %d\n",
+				model_num, fwBytes[0x05be]);
+		fwStageFree();
+		return -EINVAL;
+	}
+
+	fwSetState(FW_STATE_STAGED);
+	fwInstallReq.run = fwInstallRun;
+	ret = mcuEnqueue(&fwInstallReq);
+	if (ret < 0) {
+		fwStageFree();
+		fwSetState(FW_STATE_ERROR);
+	}
+	return ret;
+}
+
+static ssize_t fwInstall_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t bufLen) {
+	int ret;
+
+	if (!mutex_trylock(&fwMutex)) {
+		return -EBUSY;
+	}
+
+	ret = READ_ONCE(fwState);
+	if (ret == FW_STATE_STAGED || ret == FW_STATE_FLASHING
+			|| ret == FW_STATE_VALIDATING) {
+		// the staged image is in use
+		mutex_unlock(&fwMutex);
+		return -EBUSY;
+	}
+
+	if (fwBytes == NULL || (!fwHex.inRecord && bufLen >= 15
+			&& strncmp(buf, ":020000040000FA", 15) == 0)) {
+		pr_info(LOG_TAG "loading firmware file...\n");
+		ret = fwStageStart();
+		if (ret < 0) {
+			mutex_unlock(&fwMutex);
+			return ret;
+		}
+	}
+
+	ret = fwHexParse(buf, bufLen);
+	if (ret == 0) {
+		pr_info(LOG_TAG "waiting for data...\n");
+		mutex_unlock(&fwMutex);
+		return bufLen;
+	}
+	if (ret < 0) {
+		goto fail;
+	}
+
+	ret = fwStageCommit();
+	mutex_unlock(&fwMutex);
+	return ret < 0 ? ret : bufLen;
+
+	fail:
+	fwStageFree();
+	mutex_unlock(&fwMutex);
+	return -EINVAL;
+}
+
+static int fwImageLoad(const struct firmware *fw) {
+	const struct FwImageHeader *h = (const struct FwImageHeader*) fw->data;
+	u32 len;
+
+	if (fw->size < sizeof(*h) || memcmp(h->magic, FW_IMAGE_MAGIC, 4) != 0) {
+		pr_err(LOG_TAG "invalid image file - bad header\n");
+		return -EINVAL;
+	}
+	len = le32_to_cpu(h->length);
+	if (len == 0 || len > FW_MAX_SIZE || fw->size - sizeof(*h) < len) {
+		pr_err(LOG_TAG "invalid image file - bad length\n");
+		return -EINVAL;
+	}
+	if ((crc32_le(~0, fw->data + sizeof(*h), len) ^ ~0)
+			!= le32_to_cpu(h->crc)) {
+		pr_err(LOG_TAG "invalid image file - CRC error\n");
+		return -EINVAL;
+	}
+	if (h->model != model_num) {
+		pr_err(LOG_TAG "invalid image file - missmatching model %d != %d\n",
+				model_num, h->model);
+		return -EINVAL;
+	}
+	memcpy(fwBytes, fw->data + sizeof(*h), len);
+	fwMaxAddr = len - 1;
+	return 0;
+}
+
+static ssize_t fwInstallName_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	const struct firmware *fw;
+	char name[64];
+	size_t len = count;
+	int ret;
+
+	while (len > 0 && isspace(buf[len - 1])) {
+		len--;
+	}
+	if (len < 1 || len >= sizeof(name)) {
+		return -EINVAL;
+	}
+	memcpy(name, buf, len);
+	name[len] = '\0';
+
+	if (!mutex_trylock(&fwMutex)) {
+		return -EBUSY;
+	}
+
+	ret = READ_ONCE(fwState);
+	if (ret == FW_STATE_STAGED || ret == FW_STATE_FLASHING
+			|| ret == FW_STATE_VALIDATING) {
+		mutex_unlock(&fwMutex);
+		return -EBUSY;
+	}
+
+	ret = request_firmware(&fw, name, dev);
+	if (ret < 0) {
+		pr_err(LOG_TAG "error loading firmware file %s\n", name);
+		mutex_unlock(&fwMutex);
+		return ret;
+	}
+
+	pr_info(LOG_TAG "loading firmware file %s...\n", name);
+	ret = fwStageStart();
+	if (ret == 0) {
+		if (len > 4 && strcasecmp(name + len - 4, ".hex") == 0) {
+			ret = fwHexParse(fw->data, fw->size);
+			if (ret == 0) {
+				pr_err(LOG_TAG "invalid hex file - no end of file\n");
+				ret = -EINVAL;
+			}
+		} else {
+			ret = fwImageLoad(fw);
+		}
+	}
+	release_firmware(fw);
+
+	if (ret >= 0) {
+		ret = fwStageCommit();
+	} else {
+		fwStageFree();
+	}
+
+	mutex_unlock(&fwMutex);
+	return ret < 0 ? ret : count;
+}
+
+static ssize_t fwInstallProgress_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "%d\n", fwProgress);
+}
+
+static ssize_t fwInstallState_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "%s\n", fwStateNames[READ_ONCE(fwState)]);
+}
+
+static ssize_t fwInstallStats_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "written=%d\nskipped=%d\nretried=%d\n",
+			fwStats.written, fwStats.skipped, fwStats.retried);
+}
+
+static ssize_t linkErrors_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "framing_errors=%lu\nfalse_starts=%lu\noverruns=%lu\n",
+			raspberry_soft_uart_get_rx_framing_errors(),
+			raspberry_soft_uart_get_rx_false_starts(),
+			raspberry_soft_uart_get_rx_overflows());
+}
+
+static ssize_t cacheTtlMs_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "%u\n", READ_ONCE(mcuCacheTtlMs));
+}
+
+static ssize_t cacheTtlMs_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	unsigned int val;
+	int ret = kstrtouint(buf, 10, &val);
+	if (ret < 0) {
+		return ret;
+	}
+	WRITE_ONCE(mcuCacheTtlMs, val);
+	mcuCacheInvalidate("X");
+	return count;
+}
+
+static unsigned long wdtLastPing;
+static struct hrtimer wdtHbTimer;
+static unsigned int wdtHbPeriodMs;
+static unsigned int wdtLivenessDeadlineMs = WDT_LIVENESS_DEADLINE_MS_DEFAULT;
+static unsigned long wdtLivenessStamp;
+static bool wdtLivenessSet;
+
+static void wdtHeartbeat(void) {
+	gpioSetVal(&gpioWatchdogHeartbeat,
+			gpioGetVal(&gpioWatchdogHeartbeat) ? 0 : 1);
+	WRITE_ONCE(wdtLastPing, jiffies);
+}
+
+static void wdtLivenessRefresh(void) {
+	WRITE_ONCE(wdtLivenessStamp, jiffies);
+	WRITE_ONCE(wdtLivenessSet, true);
+}
+
+static bool wdtLivenessValid(void) {
+	return READ_ONCE(wdtLivenessSet)
+			&& time_before(jiffies, READ_ONCE(wdtLivenessStamp)
+					+ msecs_to_jiffies(READ_ONCE(wdtLivenessDeadlineMs)));
+}
+
+/*
+ * Autonomous heartbeat: flips the heartbeat line every period, but only
+ * while the liveness token has been refreshed within the deadline, so that
+ * a hung application still lets the watchdog expire.
+ */
+static enum hrtimer_restart wdtHbTimerHandler(struct hrtimer *tmr) {
+	unsigned int period = READ_ONCE(wdtHbPeriodMs);
+
+	if (period == 0) {
+		return HRTIMER_NORESTART;
+	}
+	if (wdtLivenessValid()) {
+		wdtHeartbeat();
+	}
+	hrtimer_forward_now(tmr, ms_to_ktime(period));
+	return HRTIMER_RESTART;
+}
+
+static ssize_t wdtHbPeriod_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "%u\n", wdtHbPeriodMs);
+}
+
+static ssize_t wdtHbPeriod_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	unsigned int val;
+	int ret = kstrtouint(buf, 10, &val);
+	if (ret < 0) {
+		return ret;
+	}
+	hrtimer_cancel(&wdtHbTimer);
+	WRITE_ONCE(wdtHbPeriodMs, val);
+	if (val > 0) {
+		hrtimer_start(&wdtHbTimer, ms_to_ktime(val), HRTIMER_MODE_REL);
+	}
+	return count;
+}
+
+static ssize_t wdtLivenessDeadline_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	return sprintf(buf, "%u\n", wdtLivenessDeadlineMs);
+}
+
+static ssize_t wdtLivenessDeadline_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	unsigned int val;
+	int ret = kstrtouint(buf, 10, &val);
+	if (ret < 0) {
+		return ret;
 	}
-	if (!fwSendCmd(0x05C0, cmd, 72, 5, "XBWOK")) {
-		mutex_unlock(&mcuMutex);
-		return -EIO;
+	if (val == 0) {
+		return -EINVAL;
 	}
+	WRITE_ONCE(wdtLivenessDeadlineMs, val);
+	return count;
+}
 
-	fwProgress = 100;
-	pr_info(LOG_TAG "progress %d%%\n", fwProgress);
-
-	pr_info(LOG_TAG "firmware installed. Waiting for shutdown...\n");
+static ssize_t wdtLiveness_show(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	unsigned long end;
 
-	mutex_unlock(&mcuMutex);
-	return bufLen;
+	if (!wdtLivenessValid()) {
+		return sprintf(buf, "0\n");
+	}
+	end = READ_ONCE(wdtLivenessStamp)
+			+ msecs_to_jiffies(READ_ONCE(wdtLivenessDeadlineMs));
+	return sprintf(buf, "%u\n", jiffies_to_msecs(end - jiffies));
 }
 
-static ssize_t fwInstallProgress_show(struct device *dev,
-		struct device_attribute *attr, char *buf) {
-	return sprintf(buf, "%d\n", fwProgress);
+static ssize_t wdtLiveness_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	wdtLivenessRefresh();
+	return count;
 }
 
-static struct device_attribute devAttrBuzzerStatus = {
+static struct GpioAttrBean devAttrBuzzerStatus = {
+	.attr = {
+		.devAttr = {
+			.attr = {
+				.name = "status",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanVal_show,
+			.store = devAttrGpioBlinkBeanVal_store,
+		},
+	},
+	.gpio = &gpioBuzzer.gpio,
+};
+
+static struct GpioAttrBean devAttrBuzzerBeep = {
 	.attr = {
-		.name = "status",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "beep",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBean_show,
+			.store = devAttrGpioBlinkBean_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.gpio = &gpioBuzzer.gpio,
 };
 
-static struct device_attribute devAttrBuzzerBeep = {
+static struct GpioAttrBean devAttrBuzzerPattern = {
 	.attr = {
-		.name = "beep",
-		.mode = 0220,
+		.devAttr = {
+			.attr = {
+				.name = "pattern",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanPattern_show,
+			.store = devAttrGpioBlinkBeanPattern_store,
+		},
 	},
-	.show = NULL,
-	.store = devAttrGpioBlink_store,
+	.gpio = &gpioBuzzer.gpio,
 };
 
-static struct device_attribute devAttrWatchdogEnabled = {
+static struct GpioAttrBean devAttrBuzzerTone = {
 	.attr = {
-		.name = "enabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "tone",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanTone_show,
+			.store = devAttrGpioBlinkBeanTone_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.gpio = &gpioBuzzer.gpio,
 };
 
-static struct device_attribute devAttrWatchdogHeartbeat = {
+static struct GpioAttrBean devAttrWatchdogEnabled = {
 	.attr = {
-		.name = "heartbeat",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "enabled",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.gpio = &gpioWatchdogEnable,
 };
 
-static struct device_attribute devAttrWatchdogExpired = {
+static struct GpioAttrBean devAttrWatchdogHeartbeat = {
 	.attr = {
-		.name = "expired",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "heartbeat",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = devAttrGpioDeb_show,
-	.store = NULL,
+	.gpio = &gpioWatchdogHeartbeat,
 };
 
-static struct device_attribute devAttrWatchdogEnableMode = {
+static struct GpioAttrBean devAttrWatchdogExpired = {
 	.attr = {
-		.name = "enable_mode",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "expired",
+				.mode = 0440,
+			},
+			.show = devAttrGpioDeb_show,
+			.store = NULL,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioWatchdogExpired.gpio,
 };
 
-static struct device_attribute devAttrWatchdogTimeout = {
+static struct DeviceAttrBean devAttrWatchdogHeartbeatPeriod = {
+	.devAttr = {
+		.attr = {
+			.name = "heartbeat_period",
+			.mode = 0660,
+		},
+		.show = wdtHbPeriod_show,
+		.store = wdtHbPeriod_store,
+	},
+};
+
+static struct DeviceAttrBean devAttrWatchdogLiveness = {
+	.devAttr = {
+		.attr = {
+			.name = "liveness",
+			.mode = 0660,
+		},
+		.show = wdtLiveness_show,
+		.store = wdtLiveness_store,
+	},
+};
+
+static struct DeviceAttrBean devAttrWatchdogLivenessDeadline = {
+	.devAttr = {
+		.attr = {
+			.name = "liveness_deadline",
+			.mode = 0660,
+		},
+		.show = wdtLivenessDeadline_show,
+		.store = wdtLivenessDeadline_store,
+	},
+};
+
+static struct McuAttrBean devAttrWatchdogEnableMode = {
 	.attr = {
-		.name = "timeout",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "enable_mode",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XWE",
+	.respLen = 4,
+	.vals = "DA",
 };
 
-static struct device_attribute devAttrWatchdogDownDelay = {
+static struct McuAttrBean devAttrWatchdogTimeout = {
 	.attr = {
-		.name = "down_delay",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "timeout",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XWH",
+	.respLen = 8,
+	.min = 1,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrWatchdogSdSwitch = {
+static struct McuAttrBean devAttrWatchdogDownDelay = {
 	.attr = {
-		.name = "sd_switch",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "down_delay",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XWW",
+	.respLen = 8,
+	.min = 1,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrRs485Mode = {
+static struct McuAttrBean devAttrWatchdogSdSwitch = {
 	.attr = {
-		.name = "mode",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "sd_switch",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
+		.models = MODEL_MASK(MODEL_CMDUO),
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XWSD",
+	.respLen = 5,
+	.min = 0,
+	.max = 8,
+	.persistent = true,
 };
 
-static struct device_attribute devAttrRs485Params = {
+static struct McuAttrBean devAttrRs485Mode = {
 	.attr = {
-		.name = "params",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "mode",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XSM",
+	.respLen = 4,
+	.vals = "APF",
 };
 
-static struct device_attribute devAttrPowerDownEnabled = {
+static struct McuAttrBean devAttrRs485Params = {
 	.attr = {
-		.name = "down_enabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "params",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.cmd = "XSP",
+	.respLen = 7,
 };
 
-static struct device_attribute devAttrPowerDownDelay = {
+static struct GpioAttrBean devAttrPowerDownEnabled = {
 	.attr = {
-		.name = "down_delay",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "down_enabled",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioShutdown,
 };
 
-static struct device_attribute devAttrPowerDownEnableMode = {
+static struct McuAttrBean devAttrPowerDownDelay = {
 	.attr = {
-		.name = "down_enable_mode",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "down_delay",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XPW",
+	.respLen = 8,
+	.min = 1,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrPowerOffTime = {
+static struct McuAttrBean devAttrPowerDownEnableMode = {
 	.attr = {
-		.name = "off_time",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "down_enable_mode",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XPE",
+	.respLen = 4,
+	.vals = "IA",
 };
 
-static struct device_attribute devAttrPowerUpDelay = {
+static struct McuAttrBean devAttrPowerOffTime = {
 	.attr = {
-		.name = "up_delay",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "off_time",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XPO",
+	.respLen = 8,
+	.min = 1,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrPowerUpMode = {
+static struct McuAttrBean devAttrPowerUpDelay = {
 	.attr = {
-		.name = "up_mode",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "up_delay",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XPU",
+	.respLen = 8,
+	.min = 0,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrPowerSdSwitch = {
+static struct McuAttrBean devAttrPowerUpMode = {
 	.attr = {
-		.name = "sd_switch",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "up_mode",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
+		.models = MODELS_UPS,
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XPP",
+	.respLen = 4,
+	.vals = "AM",
 };
 
-static struct device_attribute devAttrUpsBattery = {
+static struct McuAttrBean devAttrPowerSdSwitch = {
 	.attr = {
-		.name = "battery",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "sd_switch",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
+		.models = MODEL_MASK(MODEL_CMDUO),
 	},
-	.show = devAttrGpioDeb_show,
-	.store = NULL,
+	.cmd = "XPSD",
+	.respLen = 5,
+	.vals = "01",
+	.persistent = true,
 };
 
-static struct device_attribute devAttrUpsPowerDelay = {
+static struct GpioAttrBean devAttrUpsBattery = {
 	.attr = {
-		.name = "power_delay",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "battery",
+				.mode = 0440,
+			},
+			.show = devAttrGpioDeb_show,
+			.store = NULL,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioUpsBattery.gpio,
 };
 
-static struct device_attribute devAttrRelayStatus = {
+static struct McuAttrBean devAttrUpsPowerDelay = {
 	.attr = {
-		.name = "status",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "power_delay",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.cmd = "XUB",
+	.respLen = 8,
+	.min = 0,
+	.max = 99999,
 };
 
-static struct device_attribute devAttrLedStatus = {
+static struct GpioAttrBean devAttrRelayStatus = {
 	.attr = {
-		.name = "status",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "status",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.gpio = &gpioRelay,
 };
 
-static struct device_attribute devAttrLedBlink = {
+static struct GpioAttrBean devAttrLedStatus = {
 	.attr = {
-		.name = "blink",
-		.mode = 0220,
+		.devAttr = {
+			.attr = {
+				.name = "status",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanVal_show,
+			.store = devAttrGpioBlinkBeanVal_store,
+		},
 	},
-	.show = NULL,
-	.store = devAttrGpioBlink_store,
+	.gpio = &gpioLed.gpio,
 };
 
-static struct device_attribute devAttrButtonStatus = {
+static struct GpioAttrBean devAttrLedBlink = {
 	.attr = {
-		.name = "status",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "blink",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBean_show,
+			.store = devAttrGpioBlinkBean_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = NULL,
+	.gpio = &gpioLed.gpio,
 };
 
-static struct device_attribute devAttrButtonStatusDeb = {
+static struct GpioAttrBean devAttrLedPattern = {
 	.attr = {
-		.name = "status_deb",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "pattern",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanPattern_show,
+			.store = devAttrGpioBlinkBeanPattern_store,
+		},
 	},
-	.show = devAttrGpioDeb_show,
-	.store = NULL,
+	.gpio = &gpioLed.gpio,
 };
 
-static struct device_attribute devAttrButtonStatusDebMs = {
+static struct GpioAttrBean devAttrLedBrightness = {
 	.attr = {
-		.name = "status_deb_ms",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "brightness",
+				.mode = 0660,
+			},
+			.show = devAttrGpioBlinkBeanBrightness_show,
+			.store = devAttrGpioBlinkBeanBrightness_store,
+		},
 	},
-	.show = devAttrGpioDebMsOn_show,
-	.store = devAttrGpioDebMsOn_store,
+	.gpio = &gpioLed.gpio,
 };
 
-static struct device_attribute devAttrButtonStatusDebCnt = {
+static struct GpioAttrBean devAttrButtonStatus = {
 	.attr = {
-		.name = "status_deb_cnt",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "status",
+				.mode = 0440,
+			},
+			.show = devAttrGpio_show,
+			.store = NULL,
+		},
 	},
-	.show = devAttrGpioDebOnCnt_show,
-	.store = NULL,
+	.gpio = &gpioButton.gpio,
 };
 
-static struct device_attribute devAttrExpBusEnabled = {
+static struct GpioAttrBean devAttrButtonStatusDeb = {
 	.attr = {
-		.name = "enabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "status_deb",
+				.mode = 0440,
+			},
+			.show = devAttrGpioDeb_show,
+			.store = NULL,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.gpio = &gpioButton.gpio,
 };
 
-static struct device_attribute devAttrExpBusAux = {
+static struct GpioAttrBean devAttrButtonStatusDebMs = {
 	.attr = {
-		.name = "aux",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "status_deb_ms",
+				.mode = 0660,
+			},
+			.show = devAttrGpioDebMsOn_show,
+			.store = devAttrGpioDebMsOn_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = NULL,
+	.gpio = &gpioButton.gpio,
 };
 
-static struct device_attribute devAttrSdSdxEnabled = {
+static struct GpioAttrBean devAttrButtonStatusDebCnt = {
 	.attr = {
-		.name = "sdx_enabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "status_deb_cnt",
+				.mode = 0440,
+			},
+			.show = devAttrGpioDebOnCnt_show,
+			.store = NULL,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioButton.gpio,
 };
 
-static struct device_attribute devAttrSdSd1Enabled = {
+static struct GpioAttrBean devAttrExpBusEnabled = {
 	.attr = {
-		.name = "sd1_enabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "enabled",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioI2cExpEnable,
 };
 
-static struct device_attribute devAttrSdSdxRouting = {
+static struct GpioAttrBean devAttrExpBusAux = {
 	.attr = {
-		.name = "sdx_routing",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "aux",
+				.mode = 0440,
+			},
+			.show = devAttrGpio_show,
+			.store = NULL,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.gpio = &gpioI2cExpFeedback,
 };
 
-static struct device_attribute devAttrSdSdxDefault = {
+static struct McuAttrBean devAttrSdSdxEnabled = {
 	.attr = {
-		.name = "sdx_default",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "sdx_enabled",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = MCU_show,
-	.store = MCU_store,
+	.cmd = "XSD0",
+	.respLen = 5,
+	.vals = "012",
 };
 
-static struct device_attribute devAttrUsb1Disabled = {
+static struct McuAttrBean devAttrSdSd1Enabled = {
 	.attr = {
-		.name = "disabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "sd1_enabled",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.cmd = "XSD1",
+	.respLen = 5,
+	.vals = "012",
 };
 
-static struct device_attribute devAttrUsb1Ok = {
+static struct McuAttrBean devAttrSdSdxRouting = {
 	.attr = {
-		.name = "ok",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "sdx_routing",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = NULL,
+	.cmd = "XSDR",
+	.respLen = 5,
+	.vals = "AB",
+	.persistent = true,
 };
 
-static struct device_attribute devAttrUsb2Disabled = {
+static struct McuAttrBean devAttrSdSdxDefault = {
 	.attr = {
-		.name = "disabled",
-		.mode = 0660,
+		.devAttr = {
+			.attr = {
+				.name = "sdx_default",
+				.mode = 0660,
+			},
+			.show = MCU_show,
+			.store = MCU_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = devAttrGpio_store,
+	.cmd = "XSDP",
+	.respLen = 5,
+	.vals = "AB",
+	.persistent = true,
 };
 
-static struct device_attribute devAttrUsb2Ok = {
+static struct GpioAttrBean devAttrUsb1Disabled = {
 	.attr = {
-		.name = "ok",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "disabled",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = devAttrGpio_show,
-	.store = NULL,
+	.gpio = &gpioUsb1Disable,
 };
 
-static struct device_attribute devAttrMcuConfig = {
+static struct GpioAttrBean devAttrUsb1Ok = {
 	.attr = {
-		.name = "config",
-		.mode = 0220,
+		.devAttr = {
+			.attr = {
+				.name = "ok",
+				.mode = 0440,
+			},
+			.show = devAttrGpio_show,
+			.store = NULL,
+		},
 	},
-	.show = NULL,
-	.store = MCU_store,
+	.gpio = &gpioUsb1Fault,
 };
 
-static struct device_attribute devAttrMcuFwVersion = {
+static struct GpioAttrBean devAttrUsb2Disabled = {
 	.attr = {
-		.name = "fw_version",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "disabled",
+				.mode = 0660,
+			},
+			.show = devAttrGpio_show,
+			.store = devAttrGpio_store,
+		},
 	},
-	.show = MCU_show,
-	.store = NULL,
+	.gpio = &gpioUsb2Disable,
 };
 
-static struct device_attribute devAttrMcuFwInstall = {
+static struct GpioAttrBean devAttrUsb2Ok = {
 	.attr = {
-		.name = "fw_install",
-		.mode = 0220,
+		.devAttr = {
+			.attr = {
+				.name = "ok",
+				.mode = 0440,
+			},
+			.show = devAttrGpio_show,
+			.store = NULL,
+		},
 	},
-	.show = NULL,
-	.store = fwInstall_store,
+	.gpio = &gpioUsb2Fault,
 };
 
-static struct device_attribute devAttrMcuFwInstallProgress = {
+static struct McuAttrBean devAttrMcuConfig = {
 	.attr = {
-		.name = "fw_install_progress",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "config",
+				.mode = 0220,
+			},
+			.show = NULL,
+			.store = MCU_store,
+		},
 	},
-	.show = fwInstallProgress_show,
-	.store = NULL,
+	.cmd = "XCC",
+	.respLen = 4,
+	.vals = "SR",
 };
 
-static struct device_attribute devAttrSecElSerialNum = {
+static struct McuAttrBean devAttrMcuFwVersion = {
 	.attr = {
-		.name = "serial_num",
-		.mode = 0440,
+		.devAttr = {
+			.attr = {
+				.name = "fw_version",
+				.mode = 0440,
+			},
+			.show = MCU_show,
+			.store = NULL,
+		},
 	},
-	.show = devAttrAteccSerial_show,
-	.store = NULL,
+	.cmd = "XFW",
+	.respLen = 9,
 };
 
-static void cleanup(void) {
-	if (pLedDevice && !IS_ERR(pLedDevice)) {
-		device_remove_file(pLedDevice, &devAttrLedStatus);
-		device_remove_file(pLedDevice, &devAttrLedBlink);
+static struct DeviceAttrBean devAttrMcuFwInstall = {
+	.devAttr = {
+		.attr = {
+			.name = "fw_install",
+			.mode = 0220,
+		},
+		.show = NULL,
+		.store = fwInstall_store,
+	},
+	.models = MODELS_FW_INSTALL,
+};
 
-		device_destroy(pDeviceClass, 0);
+static struct DeviceAttrBean devAttrMcuFwInstallName = {
+	.devAttr = {
+		.attr = {
+			.name = "fw_install_name",
+			.mode = 0220,
+		},
+		.show = NULL,
+		.store = fwInstallName_store,
+	},
+	.models = MODELS_FW_INSTALL,
+};
 
-		gpioFree(&gpioLed);
-	}
+static struct DeviceAttrBean devAttrMcuFwInstallProgress = {
+	.devAttr = {
+		.attr = {
+			.name = "fw_install_progress",
+			.mode = 0440,
+		},
+		.show = fwInstallProgress_show,
+		.store = NULL,
+	},
+	.models = MODELS_FW_INSTALL,
+};
 
-	if (pButtonDevice && !IS_ERR(pButtonDevice)) {
-		device_remove_file(pButtonDevice, &devAttrButtonStatus);
-		device_remove_file(pButtonDevice, &devAttrButtonStatusDeb);
-		device_remove_file(pButtonDevice, &devAttrButtonStatusDebMs);
-		device_remove_file(pButtonDevice, &devAttrButtonStatusDebCnt);
+static struct DeviceAttrBean devAttrMcuFwInstallState = {
+	.devAttr = {
+		.attr = {
+			.name = "fw_install_state",
+			.mode = 0440,
+		},
+		.show = fwInstallState_show,
+		.store = NULL,
+	},
+	.models = MODELS_FW_INSTALL,
+};
 
-		device_destroy(pDeviceClass, 0);
+static struct DeviceAttrBean devAttrMcuFwInstallStats = {
+	.devAttr = {
+		.attr = {
+			.name = "fw_install_stats",
+			.mode = 0440,
+		},
+		.show = fwInstallStats_show,
+		.store = NULL,
+	},
+	.models = MODELS_FW_INSTALL,
+};
 
-		gpioFreeDebounce(&gpioButton);
-	}
+static struct DeviceAttrBean devAttrMcuLinkErrors = {
+	.devAttr = {
+		.attr = {
+			.name = "link_errors",
+			.mode = 0440,
+		},
+		.show = linkErrors_show,
+		.store = NULL,
+	},
+};
 
-	if (pExpBusDevice && !IS_ERR(pExpBusDevice)) {
-		device_remove_file(pExpBusDevice, &devAttrExpBusEnabled);
-		device_remove_file(pExpBusDevice, &devAttrExpBusAux);
+static struct DeviceAttrBean devAttrMcuCacheTtlMs = {
+	.devAttr = {
+		.attr = {
+			.name = "cache_ttl_ms",
+			.mode = 0660,
+		},
+		.show = cacheTtlMs_show,
+		.store = cacheTtlMs_store,
+	},
+};
 
-		device_destroy(pDeviceClass, 0);
+static struct DeviceAttrBean devAttrMcuConfigAll = {
+	.devAttr = {
+		.attr = {
+			.name = "config_all",
+			.mode = 0440,
+		},
+		.show = configAll_show,
+		.store = NULL,
+	},
+};
 
-		gpioFree(&gpioI2cExpEnable);
-		gpioFree(&gpioI2cExpFeedback);
-	}
+static struct DeviceAttrBean devAttrMcuConfigApply = {
+	.devAttr = {
+		.attr = {
+			.name = "config_apply",
+			.mode = 0660,
+		},
+		.show = configApply_show,
+		.store = configApply_store,
+	},
+};
 
-	if (pUsb1Device && !IS_ERR(pUsb1Device)) {
-		device_remove_file(pUsb1Device, &devAttrUsb1Disabled);
-		device_remove_file(pUsb1Device, &devAttrUsb1Ok);
+static struct DeviceAttrBean devAttrSecElSerialNum = {
+	.devAttr = {
+		.attr = {
+			.name = "serial_num",
+			.mode = 0440,
+		},
+		.show = devAttrAteccSerial_show,
+		.store = NULL,
+	},
+};
 
-		device_destroy(pDeviceClass, 0);
+static struct DeviceAttrBean *ledAttrs[] = {
+	&devAttrLedStatus.attr,
+	&devAttrLedBlink.attr,
+	&devAttrLedPattern.attr,
+	&devAttrLedBrightness.attr,
+	NULL,
+};
 
-		gpioFree(&gpioUsb1Disable);
-		gpioFree(&gpioUsb1Fault);
-	}
+static struct DeviceBean devLed = {
+	.name = "led",
+	.models = MODELS_CM,
+	.attrs = ledAttrs,
+};
 
-	if (pUsb2Device && !IS_ERR(pUsb2Device)) {
-		device_remove_file(pUsb2Device, &devAttrUsb2Disabled);
-		device_remove_file(pUsb2Device, &devAttrUsb2Ok);
+static struct DeviceAttrBean *buttonAttrs[] = {
+	&devAttrButtonStatus.attr,
+	&devAttrButtonStatusDeb.attr,
+	&devAttrButtonStatusDebMs.attr,
+	&devAttrButtonStatusDebCnt.attr,
+	NULL,
+};
 
-		device_destroy(pDeviceClass, 0);
+static struct DeviceBean devButton = {
+	.name = "button",
+	.models = MODELS_CM,
+	.attrs = buttonAttrs,
+};
 
-		gpioFree(&gpioUsb2Disable);
-		gpioFree(&gpioUsb2Fault);
+static struct DeviceAttrBean *expBusAttrs[] = {
+	&devAttrExpBusEnabled.attr,
+	&devAttrExpBusAux.attr,
+	NULL,
+};
+
+static struct DeviceBean devExpBus = {
+	.name = "expbus",
+	.models = MODELS_CM_EXP,
+	.attrs = expBusAttrs,
+};
+
+static struct DeviceAttrBean *usb1Attrs[] = {
+	&devAttrUsb1Disabled.attr,
+	&devAttrUsb1Ok.attr,
+	NULL,
+};
+
+static struct DeviceBean devUsb1 = {
+	.name = "usb1",
+	.models = MODELS_CM_EXP,
+	.attrs = usb1Attrs,
+};
+
+static struct DeviceAttrBean *usb2Attrs[] = {
+	&devAttrUsb2Disabled.attr,
+	&devAttrUsb2Ok.attr,
+	NULL,
+};
+
+static struct DeviceBean devUsb2 = {
+	.name = "usb2",
+	.models = MODELS_CM_EXP,
+	.attrs = usb2Attrs,
+};
+
+static struct DeviceAttrBean *sdAttrs[] = {
+	&devAttrSdSdxEnabled.attr,
+	&devAttrSdSd1Enabled.attr,
+	&devAttrSdSdxRouting.attr,
+	&devAttrSdSdxDefault.attr,
+	NULL,
+};
+
+static struct DeviceBean devSd = {
+	.name = "sd",
+	.models = MODEL_MASK(MODEL_CMDUO),
+	.attrs = sdAttrs,
+};
+
+static struct DeviceAttrBean *buzzerAttrs[] = {
+	&devAttrBuzzerStatus.attr,
+	&devAttrBuzzerBeep.attr,
+	&devAttrBuzzerPattern.attr,
+	&devAttrBuzzerTone.attr,
+	NULL,
+};
+
+static struct DeviceBean devBuzzer = {
+	.name = "buzzer",
+	.models = (MODELS_ALL & ~MODELS_CM),
+	.attrs = buzzerAttrs,
+};
+
+static struct DeviceAttrBean *relayAttrs[] = {
+	&devAttrRelayStatus.attr,
+	NULL,
+};
+
+static struct DeviceBean devRelay = {
+	.name = "relay",
+	.models = MODELS_CAN,
+	.attrs = relayAttrs,
+};
+
+static struct DeviceAttrBean *upsAttrs[] = {
+	&devAttrUpsBattery.attr,
+	&devAttrUpsPowerDelay.attr,
+	NULL,
+};
+
+static struct DeviceBean devUps = {
+	.name = "ups",
+	.models = MODELS_UPS,
+	.attrs = upsAttrs,
+};
+
+static struct DeviceAttrBean *watchdogAttrs[] = {
+	&devAttrWatchdogEnabled.attr,
+	&devAttrWatchdogHeartbeat.attr,
+	&devAttrWatchdogExpired.attr,
+	&devAttrWatchdogHeartbeatPeriod,
+	&devAttrWatchdogLiveness,
+	&devAttrWatchdogLivenessDeadline,
+	&devAttrWatchdogEnableMode.attr,
+	&devAttrWatchdogTimeout.attr,
+	&devAttrWatchdogDownDelay.attr,
+	&devAttrWatchdogSdSwitch.attr,
+	NULL,
+};
+
+static struct DeviceBean devWatchdog = {
+	.name = "watchdog",
+	.models = MODELS_ALL,
+	.attrs = watchdogAttrs,
+};
+
+static struct DeviceAttrBean *powerAttrs[] = {
+	&devAttrPowerDownEnabled.attr,
+	&devAttrPowerDownDelay.attr,
+	&devAttrPowerDownEnableMode.attr,
+	&devAttrPowerOffTime.attr,
+	&devAttrPowerUpDelay.attr,
+	&devAttrPowerUpMode.attr,
+	&devAttrPowerSdSwitch.attr,
+	NULL,
+};
+
+static struct DeviceBean devPower = {
+	.name = "power",
+	.models = MODELS_ALL,
+	.attrs = powerAttrs,
+};
+
+static struct DeviceAttrBean *rs485Attrs[] = {
+	&devAttrRs485Mode.attr,
+	&devAttrRs485Params.attr,
+	NULL,
+};
+
+static struct DeviceBean devRs485 = {
+	.name = "rs485",
+	.models = MODELS_ALL,
+	.attrs = rs485Attrs,
+};
+
+static struct DeviceAttrBean *mcuAttrs[] = {
+	&devAttrMcuConfig.attr,
+	&devAttrMcuFwVersion.attr,
+	&devAttrMcuFwInstall,
+	&devAttrMcuFwInstallName,
+	&devAttrMcuFwInstallProgress,
+	&devAttrMcuFwInstallState,
+	&devAttrMcuFwInstallStats,
+	&devAttrMcuLinkErrors,
+	&devAttrMcuCacheTtlMs,
+	&devAttrMcuConfigAll,
+	&devAttrMcuConfigApply,
+	NULL,
+};
+
+static struct DeviceBean devMcu = {
+	.name = "mcu",
+	.models = MODELS_ALL,
+	.attrs = mcuAttrs,
+};
+
+static struct DeviceAttrBean *secElAttrs[] = {
+	&devAttrSecElSerialNum,
+	NULL,
+};
+
+static struct DeviceBean devSecEl = {
+	.name = "sec_elem",
+	.models = MODELS_SEC_EL,
+	.attrs = secElAttrs,
+};
+
+static struct DeviceBean *devices[] = {
+	&devLed,
+	&devButton,
+	&devExpBus,
+	&devUsb1,
+	&devUsb2,
+	&devSd,
+	&devBuzzer,
+	&devRelay,
+	&devUps,
+	&devWatchdog,
+	&devPower,
+	&devRs485,
+	&devMcu,
+	&devSecEl,
+};
+
+static unsigned int modelMask(void) {
+	if (model_num < 0 || model_num >= 32) {
+		return 0;
 	}
+	return MODEL_MASK(model_num);
+}
 
-	if (pSdDevice && !IS_ERR(pSdDevice)) {
-		device_remove_file(pSdDevice, &devAttrSdSdxEnabled);
-		device_remove_file(pSdDevice, &devAttrSdSd1Enabled);
-		device_remove_file(pSdDevice, &devAttrSdSdxRouting);
-		device_remove_file(pSdDevice, &devAttrSdSdxDefault);
+static bool deviceCreated(struct DeviceBean *db) {
+	return db->device != NULL && !IS_ERR(db->device);
+}
+
+static bool deviceAttrAvailable(struct DeviceAttrBean *a) {
+	return a->models == 0 || (a->models & modelMask());
+}
+
+static void mcuConfigAttrsInit(void) {
+	struct DeviceAttrBean **a;
+	int i;
 
-		device_destroy(pDeviceClass, 0);
+	mcuConfigAttrsNum = 0;
+	for (i = 0; i < ARRAY_SIZE(devices); i++) {
+		if (!deviceCreated(devices[i])) {
+			continue;
+		}
+		for (a = devices[i]->attrs; *a != NULL; a++) {
+			if (deviceAttrAvailable(*a) && (*a)->devAttr.show == MCU_show
+					&& (*a)->devAttr.store == MCU_store
+					&& mcuConfigAttrsNum < MCU_CONFIG_ATTRS_MAX) {
+				mcuConfigAttrs[mcuConfigAttrsNum].db = devices[i];
+				mcuConfigAttrs[mcuConfigAttrsNum].ma = mcuAttrGet(
+						&(*a)->devAttr);
+				mcuConfigAttrsNum++;
+			}
+		}
 	}
+}
 
-	if (pBuzzerDevice && !IS_ERR(pBuzzerDevice)) {
-		device_remove_file(pBuzzerDevice, &devAttrBuzzerStatus);
-		device_remove_file(pBuzzerDevice, &devAttrBuzzerBeep);
+static bool wdtRegistered;
+
+static int wdtStart(struct watchdog_device *wdd) {
+	WRITE_ONCE(wdtLastPing, jiffies);
+	gpioSetVal(&gpioWatchdogEnable, 1);
+	return 0;
+}
 
-		device_destroy(pDeviceClass, 0);
+static int wdtStop(struct watchdog_device *wdd) {
+	// with enable mode A the MCU keeps it running: no one feeds it anymore
+	gpioSetVal(&gpioWatchdogEnable, 0);
+	return 0;
+}
 
-		gpioFree(&gpioBuzzer);
+static int wdtPing(struct watchdog_device *wdd) {
+	// with the autonomous heartbeat on, pings only refresh the liveness;
+	// only those from an open device prove userspace is alive
+	if (watchdog_active(wdd)) {
+		wdtLivenessRefresh();
+	}
+	if (READ_ONCE(wdtHbPeriodMs) == 0) {
+		wdtHeartbeat();
 	}
+	return 0;
+}
 
-	if (pRelayDevice && !IS_ERR(pRelayDevice)) {
-		device_remove_file(pRelayDevice, &devAttrRelayStatus);
+static int wdtSetTimeout(struct watchdog_device *wdd, unsigned int timeout) {
+	char val[MCU_CACHE_VAL_LEN];
+	int ret, len;
 
-		device_destroy(pDeviceClass, 0);
+	len = scnprintf(val, sizeof(val), "%u", timeout);
+	ret = mcuAttrWrite(&devAttrWatchdogTimeout, val, len);
+	if (ret < 0) {
+		return ret;
+	}
+	wdd->timeout = timeout;
+	return 0;
+}
 
-		gpioFree(&gpioRelay);
+/*
+ * The MCU does not report the time left, it is estimated from the last
+ * heartbeat unless the expired line already signals the timeout.
+ */
+static unsigned int wdtGetTimeleft(struct watchdog_device *wdd) {
+	unsigned long elapsed;
+
+	if (gpioWatchdogExpired.value == 1) {
+		return 0;
 	}
+	elapsed = (jiffies - READ_ONCE(wdtLastPing)) / HZ;
+	return elapsed < wdd->timeout ? wdd->timeout - elapsed : 0;
+}
+
+static const struct watchdog_info wdtInfo = {
+	.options = WDIOF_SETTIMEOUT | WDIOF_KEEPALIVEPING | WDIOF_MAGICCLOSE,
+	.identity = "Strato Pi watchdog",
+};
 
-	if (pUpsDevice && !IS_ERR(pUpsDevice)) {
-		device_remove_file(pUpsDevice, &devAttrUpsBattery);
-		device_remove_file(pUpsDevice, &devAttrUpsPowerDelay);
+static const struct watchdog_ops wdtOps = {
+	.owner = THIS_MODULE,
+	.start = wdtStart,
+	.stop = wdtStop,
+	.ping = wdtPing,
+	.set_timeout = wdtSetTimeout,
+	.get_timeleft = wdtGetTimeleft,
+};
+
+static struct watchdog_device wdtDevice = {
+	.info = &wdtInfo,
+	.ops = &wdtOps,
+	.min_timeout = 1,
+	.max_timeout = 99999,
+	.timeout = 60,
+};
 
-		device_destroy(pDeviceClass, 0);
+static void wdtRegister(struct device *parent) {
+	char val[MCU_CACHE_VAL_LEN];
+	unsigned int timeout;
 
-		gpioFreeDebounce(&gpioUpsBattery);
+	if (mcuAttrRead(&devAttrWatchdogTimeout, val) == 0
+			&& kstrtouint(val, 10, &timeout) == 0) {
+		wdtDevice.timeout = timeout;
 	}
+	wdtDevice.parent = parent;
+	watchdog_set_nowayout(&wdtDevice, nowayout);
+	WRITE_ONCE(wdtLastPing, jiffies);
 
-	if (pWatchdogDevice && !IS_ERR(pWatchdogDevice)) {
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogEnabled);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogHeartbeat);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogExpired);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogEnableMode);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogTimeout);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogDownDelay);
-		device_remove_file(pWatchdogDevice, &devAttrWatchdogSdSwitch);
+	// not fatal, the watchdog is still available through sysfs
+	if (watchdog_register_device(&wdtDevice)) {
+		pr_warn(LOG_TAG "failed to register watchdog device\n");
+		return;
+	}
+	wdtRegistered = true;
+}
+
+static void wdtUnregister(void) {
+	if (wdtRegistered) {
+		wdtRegistered = false;
+		watchdog_unregister_device(&wdtDevice);
+	}
+}
+
+static void cleanup(void) {
+	struct DeviceAttrBean **a;
+	int i;
 
-		device_destroy(pDeviceClass, 0);
+	wdtUnregister();
+	hrtimer_cancel(&wdtHbTimer);
+
+	// waits for a running request, e.g. a firmware install, to end
+	mcuWorkerStop();
+
+	for (i = 0; i < ARRAY_SIZE(devices); i++) {
+		if (deviceCreated(devices[i])) {
+			for (a = devices[i]->attrs; *a != NULL; a++) {
+				device_remove_file(devices[i]->device, &(*a)->devAttr);
+			}
+
+			device_destroy(pDeviceClass, 0);
+		}
 	}
 
-	if (pPowerDevice && !IS_ERR(pPowerDevice)) {
-		device_remove_file(pPowerDevice, &devAttrPowerDownEnabled);
-		device_remove_file(pPowerDevice, &devAttrPowerDownDelay);
-		device_remove_file(pPowerDevice, &devAttrPowerDownEnableMode);
-		device_remove_file(pPowerDevice, &devAttrPowerOffTime);
-		device_remove_file(pPowerDevice, &devAttrPowerUpDelay);
-		device_remove_file(pPowerDevice, &devAttrPowerUpMode);
-		device_remove_file(pPowerDevice, &devAttrPowerSdSwitch);
+	if (deviceCreated(&devLed)) {
+		gpioFreeBlink(&gpioLed);
+	}
 
-		device_destroy(pDeviceClass, 0);
+	if (deviceCreated(&devButton)) {
+		gpioFreeDebounce(&gpioButton);
 	}
 
-	if (pRs485Device && !IS_ERR(pRs485Device)) {
-		device_remove_file(pRs485Device, &devAttrRs485Mode);
-		device_remove_file(pRs485Device, &devAttrRs485Params);
+	if (deviceCreated(&devExpBus)) {
+		gpioFree(&gpioI2cExpEnable);
+		gpioFree(&gpioI2cExpFeedback);
+	}
 
-		device_destroy(pDeviceClass, 0);
+	if (deviceCreated(&devUsb1)) {
+		gpioFree(&gpioUsb1Disable);
+		gpioFree(&gpioUsb1Fault);
 	}
 
-	if (pMcuDevice && !IS_ERR(pMcuDevice)) {
-		device_remove_file(pMcuDevice, &devAttrMcuConfig);
-		device_remove_file(pMcuDevice, &devAttrMcuFwVersion);
-		device_remove_file(pMcuDevice, &devAttrMcuFwInstall);
-		device_remove_file(pMcuDevice, &devAttrMcuFwInstallProgress);
+	if (deviceCreated(&devUsb2)) {
+		gpioFree(&gpioUsb2Disable);
+		gpioFree(&gpioUsb2Fault);
+	}
 
-		device_destroy(pDeviceClass, 0);
+	if (deviceCreated(&devBuzzer)) {
+		gpioFreeBlink(&gpioBuzzer);
 	}
 
-	if (pSecElDevice && !IS_ERR(pSecElDevice)) {
-		device_remove_file(pSecElDevice, &devAttrSecElSerialNum);
+	if (deviceCreated(&devRelay)) {
+		gpioFree(&gpioRelay);
+	}
 
-		device_destroy(pDeviceClass, 0);
+	if (deviceCreated(&devUps)) {
+		gpioFreeDebounce(&gpioUpsBattery);
 	}
 
 	if (!IS_ERR(pDeviceClass)) {
@@ -1306,13 +3030,17 @@ static void cleanup(void) {
 	gpioFreeDebounce(&gpioWatchdogExpired);
 	gpioFree(&gpioShutdown);
 
+	debugfs_remove_recursive(pDebugfsDir);
+	pDebugfsDir = NULL;
+
 	if (softUartInitialized) {
 		if (!raspberry_soft_uart_finalize()) {
 			pr_err(LOG_TAG "error finalizing soft UART\n");
 		}
 	}
 
-	mutex_destroy(&mcuMutex);
+	fwStageFree();
+	mutex_destroy(&fwMutex);
 }
 
 static void setGPIO(void) {
@@ -1321,7 +3049,7 @@ static void setGPIO(void) {
 		gpioWatchdogHeartbeat.name = stratopi_gp27;
 		gpioWatchdogExpired.gpio.name = stratopi_gp17;
 		gpioShutdown.name = stratopi_gp18;
-		gpioLed.name = stratopi_gp16;
+		gpioLed.gpio.name = stratopi_gp16;
 		gpioButton.gpio.name = stratopi_gp25;
 		gpioSoftSerTx.name = stratopi_gp23;
 		gpioSoftSerRx.name = stratopi_gp24;
@@ -1330,7 +3058,7 @@ static void setGPIO(void) {
 		gpioWatchdogHeartbeat.name = stratopi_gp32;
 		gpioWatchdogExpired.gpio.name = stratopi_gp17;
 		gpioShutdown.name = stratopi_gp18;
-		gpioLed.name = stratopi_gp16;
+		gpioLed.gpio.name = stratopi_gp16;
 		gpioButton.gpio.name = stratopi_gp38;
 		gpioI2cExpEnable.name = stratopi_gp6;
 		gpioI2cExpFeedback.name = stratopi_gp34;
@@ -1341,7 +3069,7 @@ static void setGPIO(void) {
 		gpioSoftSerTx.name = stratopi_gp37;
 		gpioSoftSerRx.name = stratopi_gp33;
 	} else {
-		gpioBuzzer.name = stratopi_gp20;
+		gpioBuzzer.gpio.name = stratopi_gp20;
 		gpioWatchdogEnable.name = stratopi_gp6;
 		gpioWatchdogHeartbeat.name = stratopi_gp5;
 		gpioWatchdogExpired.gpio.name = stratopi_gp12;
@@ -1363,7 +3091,7 @@ static bool softUartInit(void) {
 	if (!raspberry_soft_uart_init(gpioSoftSerTx.desc, gpioSoftSerRx.desc)) {
 		return false;
 	}
-	if (!raspberry_soft_uart_set_baudrate(1200)) {
+	if (!raspberry_soft_uart_set_baudrate(SOFT_UART_BAUD)) {
 		raspberry_soft_uart_finalize();
 		return false;
 	}
@@ -1374,14 +3102,14 @@ static bool softUartInit(void) {
 static bool getFwVerAndModelNumber(int modelTry) {
 	char *end = NULL;
 	if (!softUartSendAndWait("XFW?", 4, 9, 300, false)
-			&& softUartRxBuffIdx < 6) {
+			&& softUartRespLen < 6) {
 		return false;
 	}
-	fwVerMaj = simple_strtol((const char*) (softUartRxBuff + 3), &end, 10);
+	fwVerMaj = simple_strtol(softUartResp + 3, &end, 10);
 	fwVerMin = simple_strtol(end + 1, &end, 10);
 	pr_info(LOG_TAG "FW version %d.%d\n", fwVerMaj, fwVerMin);
 	if (fwVerMaj < 4) {
-		if (modelTry == MODEL_CM && fwVerMin >= 5 && softUartRxBuffIdx == 6) {
+		if (modelTry == MODEL_CM && fwVerMin >= 5 && softUartRespLen == 6) {
 			model_num = MODEL_CM;
 			return true;
 		}
@@ -1459,6 +3187,9 @@ static bool detectFwVerAndModel(void) {
 }
 
 static int stratopi_init(struct platform_device *pdev) {
+	struct DeviceBean *db;
+	struct DeviceAttrBean **a;
+	int i;
 	int result = 0;
 	bool modNumDetected = false;
 
@@ -1466,7 +3197,15 @@ static int stratopi_init(struct platform_device *pdev) {
 
 	pr_info(LOG_TAG "init\n");
 
-	mutex_init(&mcuMutex);
+	mutex_init(&fwMutex);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	hrtimer_setup(&wdtHbTimer, wdtHbTimerHandler, CLOCK_MONOTONIC,
+			HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&wdtHbTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	wdtHbTimer.function = &wdtHbTimerHandler;
+#endif
 
 	gpioSetPlatformDev(pdev);
 
@@ -1476,6 +3215,12 @@ static int stratopi_init(struct platform_device *pdev) {
 		goto fail;
 	}
 
+	if (!raspberry_soft_uart_set_rx_error_callback(&softUartRxErrorCallback)) {
+		pr_err(LOG_TAG "error setting soft UART error callback\n");
+		result = -1;
+		goto fail;
+	}
+
 	if (model_num <= 0) {
 		pr_info(LOG_TAG "detecting model...\n");
 		modNumDetected = detectFwVerAndModel();
@@ -1508,6 +3253,16 @@ static int stratopi_init(struct platform_device *pdev) {
 
 	softUartInitialized = true;
 
+	pDebugfsDir = debugfs_create_dir("stratopi", NULL);
+	raspberry_soft_uart_debugfs_init(pDebugfsDir);
+	mcuDebugfsInit(pDebugfsDir);
+
+	if (!mcuWorkerStart()) {
+		pr_err(LOG_TAG "error starting MCU worker\n");
+		result = -1;
+		goto fail;
+	}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
 	pDeviceClass = class_create("stratopi");
 #else
@@ -1519,198 +3274,36 @@ static int stratopi_init(struct platform_device *pdev) {
 		goto fail;
 	}
 
-	if (model_num == MODEL_CM || model_num == MODEL_CMDUO
-			|| model_num == MODEL_CM_2) {
-		pLedDevice = device_create(pDeviceClass, NULL, 0, NULL, "led");
-		pButtonDevice = device_create(pDeviceClass, NULL, 0, NULL, "button");
-
-		if (IS_ERR(pLedDevice) || IS_ERR(pButtonDevice)) {
-			pr_err(LOG_TAG "failed to create devices\n");
-			result = -1;
-			goto fail;
-		}
-
-		if (model_num == MODEL_CMDUO || model_num == MODEL_CM_2) {
-			pExpBusDevice = device_create(pDeviceClass, NULL, 0, NULL,
-					"expbus");
-			pUsb1Device = device_create(pDeviceClass, NULL, 0, NULL, "usb1");
-			pUsb2Device = device_create(pDeviceClass, NULL, 0, NULL, "usb2");
-
-			if (IS_ERR(pExpBusDevice) || IS_ERR(pUsb1Device)
-					|| IS_ERR(pUsb2Device)) {
-				pr_err(LOG_TAG "failed to create devices\n");
-				result = -1;
-				goto fail;
-			}
-		}
-
-		if (model_num == MODEL_CMDUO) {
-			pSdDevice = device_create(pDeviceClass, NULL, 0, NULL, "sd");
-
-			if (IS_ERR(pSdDevice)) {
-				pr_err(LOG_TAG "failed to create devices\n");
-				result = -1;
-				goto fail;
-			}
+	for (i = 0; i < ARRAY_SIZE(devices); i++) {
+		db = devices[i];
+		if (!(db->models & modelMask())) {
+			continue;
 		}
-	} else {
-		pBuzzerDevice = device_create(pDeviceClass, NULL, 0, NULL, "buzzer");
 
-		if (IS_ERR(pBuzzerDevice)) {
+		db->device = device_create(pDeviceClass, NULL, 0, NULL, db->name);
+		if (IS_ERR(db->device)) {
 			pr_err(LOG_TAG "failed to create devices\n");
 			result = -1;
 			goto fail;
 		}
 
-		if (model_num == MODEL_CAN || model_num == MODEL_CAN_2) {
-			pRelayDevice = device_create(pDeviceClass, NULL, 0, NULL, "relay");
-
-			if (IS_ERR(pRelayDevice)) {
-				pr_err(LOG_TAG "failed to create devices\n");
-				result = -1;
-				goto fail;
-			}
-
-		} else if (model_num == MODEL_UPS || model_num == MODEL_UPS_3) {
-			pUpsDevice = device_create(pDeviceClass, NULL, 0, NULL, "ups");
-
-			if (IS_ERR(pUpsDevice)) {
-				pr_err(LOG_TAG "failed to create devices\n");
-				result = -1;
-				goto fail;
+		for (a = db->attrs; *a != NULL; a++) {
+			if (deviceAttrAvailable(*a)) {
+				result |= device_create_file(db->device, &(*a)->devAttr);
 			}
 		}
 	}
 
-	pWatchdogDevice = device_create(pDeviceClass, NULL, 0, NULL, "watchdog");
-	pPowerDevice = device_create(pDeviceClass, NULL, 0, NULL, "power");
-	pRs485Device = device_create(pDeviceClass, NULL, 0, NULL, "rs485");
-	pMcuDevice = device_create(pDeviceClass, NULL, 0, NULL, "mcu");
-
-	if (IS_ERR(pRs485Device) || IS_ERR(pWatchdogDevice) || IS_ERR(pPowerDevice)
-			|| IS_ERR(pMcuDevice)) {
-		pr_err(LOG_TAG "failed to create devices\n");
-		result = -1;
-		goto fail;
-	}
-
-	if (model_num >= MODEL_BASE_3) {
-		pSecElDevice = device_create(pDeviceClass, NULL, 0, NULL, "sec_elem");
-
-		if (IS_ERR(pSecElDevice)) {
-			pr_err(LOG_TAG "failed to create devices\n");
-			result = -1;
-			goto fail;
-		}
-	}
-
-	if (pBuzzerDevice) {
-		result |= device_create_file(pBuzzerDevice, &devAttrBuzzerStatus);
-		result |= device_create_file(pBuzzerDevice, &devAttrBuzzerBeep);
-	}
-
-	if (pWatchdogDevice) {
-		result |= device_create_file(pWatchdogDevice, &devAttrWatchdogEnabled);
-		result |= device_create_file(pWatchdogDevice,
-				&devAttrWatchdogHeartbeat);
-		result |= device_create_file(pWatchdogDevice, &devAttrWatchdogExpired);
-		result |= device_create_file(pWatchdogDevice,
-				&devAttrWatchdogEnableMode);
-		result |= device_create_file(pWatchdogDevice, &devAttrWatchdogTimeout);
-		result |= device_create_file(pWatchdogDevice,
-				&devAttrWatchdogDownDelay);
-		if (pSdDevice) {
-			result |= device_create_file(pWatchdogDevice,
-					&devAttrWatchdogSdSwitch);
-		}
-	}
-
-	if (pRs485Device) {
-		result |= device_create_file(pRs485Device, &devAttrRs485Mode);
-		result |= device_create_file(pRs485Device, &devAttrRs485Params);
-	}
-
-	if (pPowerDevice) {
-		result |= device_create_file(pPowerDevice, &devAttrPowerDownEnabled);
-		result |= device_create_file(pPowerDevice, &devAttrPowerDownDelay);
-		result |= device_create_file(pPowerDevice, &devAttrPowerDownEnableMode);
-		result |= device_create_file(pPowerDevice, &devAttrPowerOffTime);
-		result |= device_create_file(pPowerDevice, &devAttrPowerUpDelay);
-		if (pUpsDevice) {
-			result |= device_create_file(pPowerDevice, &devAttrPowerUpMode);
-		}
-		if (pSdDevice) {
-			result |= device_create_file(pPowerDevice, &devAttrPowerSdSwitch);
-		}
-	}
-
-	if (pUpsDevice) {
-		result |= device_create_file(pUpsDevice, &devAttrUpsBattery);
-		result |= device_create_file(pUpsDevice, &devAttrUpsPowerDelay);
-	}
-
-	if (pRelayDevice) {
-		result |= device_create_file(pRelayDevice, &devAttrRelayStatus);
-	}
-
-	if (pLedDevice) {
-		result |= device_create_file(pLedDevice, &devAttrLedStatus);
-		result |= device_create_file(pLedDevice, &devAttrLedBlink);
-	}
-
-	if (pButtonDevice) {
-		result |= device_create_file(pButtonDevice, &devAttrButtonStatus);
-		result |= device_create_file(pButtonDevice, &devAttrButtonStatusDeb);
-		result |= device_create_file(pButtonDevice, &devAttrButtonStatusDebMs);
-		result |= device_create_file(pButtonDevice, &devAttrButtonStatusDebCnt);
-	}
-
-	if (pExpBusDevice) {
-		result |= device_create_file(pExpBusDevice, &devAttrExpBusEnabled);
-		result |= device_create_file(pExpBusDevice, &devAttrExpBusAux);
-	}
-
-	if (pSdDevice) {
-		result |= device_create_file(pSdDevice, &devAttrSdSdxEnabled);
-		result |= device_create_file(pSdDevice, &devAttrSdSd1Enabled);
-		result |= device_create_file(pSdDevice, &devAttrSdSdxRouting);
-		result |= device_create_file(pSdDevice, &devAttrSdSdxDefault);
-	}
-
-	if (pUsb1Device) {
-		result |= device_create_file(pUsb1Device, &devAttrUsb1Disabled);
-		result |= device_create_file(pUsb1Device, &devAttrUsb1Ok);
-	}
-
-	if (pUsb2Device) {
-		result |= device_create_file(pUsb2Device, &devAttrUsb2Disabled);
-		result |= device_create_file(pUsb2Device, &devAttrUsb2Ok);
-	}
-
-	if (pMcuDevice) {
-		result |= device_create_file(pMcuDevice, &devAttrMcuConfig);
-		result |= device_create_file(pMcuDevice, &devAttrMcuFwVersion);
-		if (model_num == MODEL_CMDUO || model_num == MODEL_UPS_3
-				|| model_num == MODEL_BASE_3
-				|| model_num == MODEL_CAN_2 || model_num == MODEL_CM_2) {
-			result |= device_create_file(pMcuDevice, &devAttrMcuFwInstall);
-			result |= device_create_file(pMcuDevice,
-					&devAttrMcuFwInstallProgress);
-		}
-	}
-
-	if (pSecElDevice) {
-		result |= device_create_file(pSecElDevice, &devAttrSecElSerialNum);
-	}
-
 	if (result) {
 		pr_err(LOG_TAG "failed to create device files\n");
 		result = -1;
 		goto fail;
 	}
 
-	if (pBuzzerDevice) {
-		result |= gpioInit(&gpioBuzzer);
+	mcuConfigAttrsInit();
+
+	if (devBuzzer.device) {
+		result |= gpioInitBlink(&gpioBuzzer);
 	}
 
 	result |= gpioInit(&gpioWatchdogEnable);
@@ -1719,33 +3312,33 @@ static int stratopi_init(struct platform_device *pdev) {
 
 	result |= gpioInit(&gpioShutdown);
 
-	if (pUpsDevice) {
+	if (devUps.device) {
 		result |= gpioInitDebounce(&gpioUpsBattery);
 	}
 
-	if (pRelayDevice) {
+	if (devRelay.device) {
 		result |= gpioInit(&gpioRelay);
 	}
 
-	if (pLedDevice) {
-		result |= gpioInit(&gpioLed);
+	if (devLed.device) {
+		result |= gpioInitBlink(&gpioLed);
 	}
 
-	if (pButtonDevice) {
+	if (devButton.device) {
 		result |= gpioInitDebounce(&gpioButton);
 	}
 
-	if (pExpBusDevice) {
+	if (devExpBus.device) {
 		result |= gpioInit(&gpioI2cExpEnable);
 		result |= gpioInit(&gpioI2cExpFeedback);
 	}
 
-	if (pUsb1Device) {
+	if (devUsb1.device) {
 		result |= gpioInit(&gpioUsb1Disable);
 		result |= gpioInit(&gpioUsb1Fault);
 	}
 
-	if (pUsb2Device) {
+	if (devUsb2.device) {
 		result |= gpioInit(&gpioUsb2Disable);
 		result |= gpioInit(&gpioUsb2Fault);
 	}
@@ -1755,6 +3348,8 @@ static int stratopi_init(struct platform_device *pdev) {
 		goto fail;
 	}
 
+	wdtRegister(&pdev->dev);
+
 	pr_info(LOG_TAG "ready\n");
 	return 0;
 
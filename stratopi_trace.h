@@ -0,0 +1,127 @@
+/*
+ * stratopi
+ *
+ *     Copyright (C) 2019-2025 Sfera Labs S.r.l.
+ *
+ *     For information, see the Strato Pi web site:
+ *     https://www.sferalabs.cc/strato-pi
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE.txt file for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM stratopi
+
+#if !defined(_STRATOPI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _STRATOPI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Commands are traced by their first 3 characters, the remaining ones
+ * may be binary data.
+ */
+TRACE_EVENT(stratopi_mcu_cmd,
+	TP_PROTO(const char *cmd, int cmdLen, int respLen, int timeout),
+	TP_ARGS(cmd, cmdLen, respLen, timeout),
+	TP_STRUCT__entry(
+		__array(char, cmd, 4)
+		__field(int, cmd_len)
+		__field(int, resp_len)
+		__field(int, timeout)
+	),
+	TP_fast_assign(
+		memset(__entry->cmd, 0, sizeof(__entry->cmd));
+		memcpy(__entry->cmd, cmd, min(cmdLen, 3));
+		__entry->cmd_len = cmdLen;
+		__entry->resp_len = respLen;
+		__entry->timeout = timeout;
+	),
+	TP_printk("cmd=%s cmd_len=%d resp_len=%d timeout=%d", __entry->cmd,
+		__entry->cmd_len, __entry->resp_len, __entry->timeout)
+);
+
+TRACE_EVENT(stratopi_mcu_cmd_retry,
+	TP_PROTO(const char *cmd, int cmdLen, int try, int respLen,
+		int expectedLen),
+	TP_ARGS(cmd, cmdLen, try, respLen, expectedLen),
+	TP_STRUCT__entry(
+		__array(char, cmd, 4)
+		__field(int, try)
+		__field(int, resp_len)
+		__field(int, expected_len)
+	),
+	TP_fast_assign(
+		memset(__entry->cmd, 0, sizeof(__entry->cmd));
+		memcpy(__entry->cmd, cmd, min(cmdLen, 3));
+		__entry->try = try;
+		__entry->resp_len = respLen;
+		__entry->expected_len = expectedLen;
+	),
+	TP_printk("cmd=%s try=%d resp_len=%d expected_len=%d", __entry->cmd,
+		__entry->try, __entry->resp_len, __entry->expected_len)
+);
+
+TRACE_EVENT(stratopi_mcu_cmd_done,
+	TP_PROTO(const char *cmd, int cmdLen, bool ok, int tries,
+		s64 latencyUs),
+	TP_ARGS(cmd, cmdLen, ok, tries, latencyUs),
+	TP_STRUCT__entry(
+		__array(char, cmd, 4)
+		__field(bool, ok)
+		__field(int, tries)
+		__field(s64, latency_us)
+	),
+	TP_fast_assign(
+		memset(__entry->cmd, 0, sizeof(__entry->cmd));
+		memcpy(__entry->cmd, cmd, min(cmdLen, 3));
+		__entry->ok = ok;
+		__entry->tries = tries;
+		__entry->latency_us = latencyUs;
+	),
+	TP_printk("cmd=%s ok=%d tries=%d latency_us=%lld", __entry->cmd,
+		__entry->ok, __entry->tries, __entry->latency_us)
+);
+
+TRACE_EVENT(stratopi_fw_block_written,
+	TP_PROTO(int addr, int tries, bool ok),
+	TP_ARGS(addr, tries, ok),
+	TP_STRUCT__entry(
+		__field(int, addr)
+		__field(int, tries)
+		__field(bool, ok)
+	),
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->tries = tries;
+		__entry->ok = ok;
+	),
+	TP_printk("addr=0x%04x tries=%d ok=%d", __entry->addr, __entry->tries,
+		__entry->ok)
+);
+
+TRACE_EVENT(stratopi_fw_block_verified,
+	TP_PROTO(int addr, bool match),
+	TP_ARGS(addr, match),
+	TP_STRUCT__entry(
+		__field(int, addr)
+		__field(bool, match)
+	),
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->match = match;
+	),
+	TP_printk("addr=0x%04x match=%d", __entry->addr, __entry->match)
+);
+
+#endif /* _STRATOPI_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE stratopi_trace
+#include <trace/define_trace.h>